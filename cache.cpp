@@ -0,0 +1,313 @@
+/*
+ * cache.cpp: A plugin for the Video Disk Recorder
+ *
+ * See the README file for copyright information and how to reach the author.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "cache.h"
+#include "event.h"
+#include "import.h"
+#include "debug.h"
+
+extern char *strcatrealloc(char *, const char*);
+
+cXMLTVCache::cXMLTVCache()
+{
+    loaded=false;
+    soundex=false;
+    generation=0;
+}
+
+uint64_t cXMLTVCache::soundexhash(const char *Title)
+{
+    if (!soundex || !Title) return 0;
+    char wstr[128];
+    if (!cImport::SoundEx((char *) &wstr,(char *) Title,0,1)) return 0;
+    return HashStr(wstr);
+}
+
+void cXMLTVCache::insert(std::vector<entry> &Events, const entry &Entry)
+{
+    Events.insert(std::upper_bound(Events.begin(),Events.end(),Entry,before),Entry);
+}
+
+void cXMLTVCache::addbloom(const std::string &ChannelID, const entry &Entry)
+{
+    std::map<std::string,bloom>::iterator it=blooms.find(ChannelID);
+    if (it==blooms.end())
+    {
+        bloom b;
+        memset(&b,0,sizeof(b));
+        it=blooms.insert(std::make_pair(ChannelID,b)).first;
+    }
+    bloomadd(it->second,HashInt(Entry.eiteventid));
+    bloomadd(it->second,Entry.titlehash);
+    if (Entry.soundexhash) bloomadd(it->second,Entry.soundexhash);
+}
+
+uint64_t cXMLTVCache::misskey(const char *ChannelID, const cEvent *Event)
+{
+    uint64_t hash=HashStr(ChannelID);
+    hash=HashInt(Event->EventID(),hash);
+    hash=HashInt(Event->StartTime(),hash);
+    hash=HashStr(Event->Title(),hash);
+    return HashStr(Event->ShortText(),hash);
+}
+
+bool cXMLTVCache::load(sqlite3 *Db)
+{
+    if (!Db) return false;
+
+    char *channellist=NULL;
+    if (loaded)
+    {
+        for (std::set<std::string>::iterator it=dirty.begin(); it!=dirty.end(); ++it)
+        {
+            if (channellist) channellist=strcatrealloc(channellist,",");
+            channellist=strcatrealloc(channellist,"'");
+            channellist=strcatrealloc(channellist,it->c_str());
+            channellist=strcatrealloc(channellist,"'");
+        }
+    }
+
+    // only events which can still be sent by EIT
+    char *sql;
+    if (asprintf(&sql,"select channelid,rowid,starttime,eiteventid,srcidx,title,soundex_title from epg " \
+                 "where endtime>=%li%s%s%s;",time(NULL)-720,
+                 channellist ? " and channelid in (" : "",channellist ? channellist : "",
+                 channellist ? ")" : "")==-1)
+    {
+        free(channellist);
+        esyslog("out of memory");
+        return false;
+    }
+    free(channellist);
+
+    sqlite3_stmt *stmt;
+    int ret=sqlite3_prepare_v2(Db,sql,strlen(sql),&stmt,NULL);
+    free(sql);
+    if (ret!=SQLITE_OK)
+    {
+        tsyslog("sqlite3: %i %s (cache)",ret,sqlite3_errmsg(Db));
+        return false;
+    }
+
+    if (loaded)
+    {
+        for (std::set<std::string>::iterator it=dirty.begin(); it!=dirty.end(); ++it)
+        {
+            channels.erase(*it);
+            blooms.erase(*it);
+        }
+    }
+    else
+    {
+        channels.clear();
+        blooms.clear();
+    }
+
+    int cnt=0;
+    while ((ret=sqlite3_step(stmt))==SQLITE_ROW)
+    {
+        const char *channelid=(const char *) sqlite3_column_text(stmt,0);
+        if (!channelid) continue;
+        const char *title=(const char *) sqlite3_column_text(stmt,5);
+        entry e;
+        e.rowid=sqlite3_column_int64(stmt,1);
+        e.starttime=sqlite3_column_int64(stmt,2);
+        e.eiteventid=sqlite3_column_int(stmt,3);
+        e.srcidx=sqlite3_column_int(stmt,4);
+        e.titlehash=HashStr(title);
+        const char *stitle=(const char *) sqlite3_column_text(stmt,6);
+        e.soundexhash=(soundex && stitle) ? HashStr(stitle) : 0;
+        channels[channelid].push_back(e);
+        addbloom(channelid,e);
+        cnt++;
+    }
+    sqlite3_finalize(stmt);
+    if (ret!=SQLITE_DONE)
+    {
+        // incomplete, try again next time
+        loaded=false;
+        return false;
+    }
+
+    for (std::map<std::string,std::vector<entry> >::iterator it=channels.begin(); it!=channels.end(); ++it)
+    {
+        std::stable_sort(it->second.begin(),it->second.end(),before);
+    }
+    tsyslog("cache: loaded %i events for %s channels",cnt,loaded ? "changed" : "all");
+    loaded=true;
+    dirty.clear();
+    return true;
+}
+
+void cXMLTVCache::Clear()
+{
+    cMutexLock lock(&mutex);
+    channels.clear();
+    blooms.clear();
+    misses.clear();
+    dirty.clear();
+    loaded=false;
+    generation++;
+}
+
+void cXMLTVCache::Invalidate(const char *ChannelID)
+{
+    if (!ChannelID) return;
+    cMutexLock lock(&mutex);
+    if (loaded) dirty.insert(ChannelID);
+    misses.clear(); // new data may match
+    generation++;
+}
+
+void cXMLTVCache::Add(const char *ChannelID, time_t StartTime, tEventID EITEventID, int SrcIdx,
+                      const char *Title, sqlite3_int64 RowID)
+{
+    if (!ChannelID) return;
+    cMutexLock lock(&mutex);
+    if (!loaded) return;
+    if (dirty.find(ChannelID)!=dirty.end()) return;
+    entry e;
+    e.rowid=RowID;
+    e.starttime=StartTime;
+    e.eiteventid=EITEventID;
+    e.srcidx=SrcIdx;
+    e.titlehash=HashStr(Title);
+    e.soundexhash=soundexhash(Title);
+    insert(channels[ChannelID],e);
+    addbloom(ChannelID,e);
+}
+
+void cXMLTVCache::SetEITEventID(const char *ChannelID, sqlite3_int64 RowID, tEventID EITEventID)
+{
+    if (!ChannelID) return;
+    cMutexLock lock(&mutex);
+    if (!loaded) return;
+    if (RowID)
+    {
+        std::map<std::string,std::vector<entry> >::iterator it=channels.find(ChannelID);
+        if (it!=channels.end())
+        {
+            for (size_t i=0; i<it->second.size(); i++)
+            {
+                if (it->second[i].rowid==RowID)
+                {
+                    it->second[i].eiteventid=EITEventID;
+                    addbloom(ChannelID,it->second[i]);
+                    return;
+                }
+            }
+        }
+    }
+    // row unknown, reload this channel
+    dirty.insert(ChannelID);
+}
+
+sqlite3_int64 cXMLTVCache::Lookup(sqlite3 *Db, const char *ChannelID, const cEvent *Event, int TimeDiff)
+{
+    if (!ChannelID || !Event) return -1;
+    cMutexLock lock(&mutex);
+    if (!loaded || !dirty.empty())
+    {
+        if (!load(Db)) return -1;
+    }
+
+    std::map<std::string,std::vector<entry> >::iterator it=channels.find(ChannelID);
+    if (it==channels.end()) return 0;
+    std::vector<entry> &events=it->second;
+
+    uint64_t shash=soundexhash(Event->Title());
+    uint64_t thash=HashStr(Event->Title());
+    std::map<std::string,bloom>::iterator b=blooms.find(ChannelID);
+    if ((b!=blooms.end()) && !bloomhas(b->second,HashInt(Event->EventID())) &&
+            !bloomhas(b->second,shash ? shash : thash)) return 0;
+
+    entry from;
+    from.starttime=Event->StartTime()-TimeDiff;
+    std::vector<entry>::iterator first=std::lower_bound(events.begin(),events.end(),from,before);
+
+    // 1st with eiteventid, 2nd with (soundex of) title
+    for (int pass=0; pass<2; pass++)
+    {
+        sqlite3_int64 rowid=0;
+        int bestdiff=0,bestidx=0;
+        for (std::vector<entry>::iterator p=first; p!=events.end(); ++p)
+        {
+            if (p->starttime>Event->StartTime()+TimeDiff) break;
+            if (!pass)
+            {
+                if (p->eiteventid!=Event->EventID()) continue;
+            }
+            else
+            {
+                if (shash)
+                {
+                    if (p->soundexhash!=shash) continue;
+                }
+                else
+                {
+                    if (p->titlehash!=thash) continue;
+                }
+            }
+            int diff=abs((int) (p->starttime-Event->StartTime()));
+            if (!rowid || (diff<bestdiff) || ((diff==bestdiff) && (p->srcidx<bestidx)))
+            {
+                rowid=p->rowid;
+                bestdiff=diff;
+                bestidx=p->srcidx;
+            }
+        }
+        if (rowid) return rowid;
+    }
+    return 0;
+}
+
+bool cXMLTVCache::KnownMiss(const char *ChannelID, const cEvent *Event)
+{
+    if (!ChannelID || !Event) return false;
+    cMutexLock lock(&mutex);
+    std::map<uint64_t,time_t>::iterator it=misses.find(misskey(ChannelID,Event));
+    if (it==misses.end()) return false;
+    if (it->second<time(NULL))
+    {
+        misses.erase(it);
+        return false;
+    }
+    return true;
+}
+
+void cXMLTVCache::AddMiss(const char *ChannelID, const cEvent *Event)
+{
+    if (!ChannelID || !Event) return;
+    cMutexLock lock(&mutex);
+    time_t now=time(NULL);
+    if (misses.size()>=MAXMISSES)
+    {
+        for (std::map<uint64_t,time_t>::iterator it=misses.begin(); it!=misses.end();)
+        {
+            if (it->second<now)
+            {
+                misses.erase(it++);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        if (misses.size()>=MAXMISSES) misses.clear();
+    }
+    misses[misskey(ChannelID,Event)]=now+MISSTTL;
+}
+
+void cXMLTVCache::ClearMisses()
+{
+    cMutexLock lock(&mutex);
+    misses.clear();
+}
@@ -0,0 +1,92 @@
+/*
+ * cache.h: A plugin for the Video Disk Recorder
+ *
+ * See the README file for copyright information and how to reach the author.
+ *
+ */
+
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <sqlite3.h>
+#include <stdint.h>
+#include <vdr/epg.h>
+#include <vdr/thread.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// resident copy of the match keys of the epg table, used to
+// find the xmltv row of an EIT event without asking sqlite
+class cXMLTVCache
+{
+private:
+    struct entry
+    {
+        time_t starttime;
+        tEventID eiteventid;
+        int srcidx;
+        uint64_t titlehash;
+        uint64_t soundexhash;
+        sqlite3_int64 rowid;
+    };
+    static bool before(const entry &a, const entry &b)
+    {
+        return a.starttime<b.starttime;
+    }
+    enum
+    {
+        BLOOMBITS=16384,
+        MAXMISSES=8192,
+        MISSTTL=900
+    };
+    struct bloom
+    {
+        uint64_t bits[BLOOMBITS/64];
+    };
+    static void bloomadd(bloom &Bloom, uint64_t Hash)
+    {
+        Bloom.bits[(Hash % BLOOMBITS)/64]|=1ULL<<(Hash % 64);
+        Bloom.bits[((Hash>>32) % BLOOMBITS)/64]|=1ULL<<((Hash>>32) % 64);
+    }
+    static bool bloomhas(const bloom &Bloom, uint64_t Hash)
+    {
+        return (Bloom.bits[(Hash % BLOOMBITS)/64] & (1ULL<<(Hash % 64))) &&
+               (Bloom.bits[((Hash>>32) % BLOOMBITS)/64] & (1ULL<<((Hash>>32) % 64)));
+    }
+    std::map<std::string,std::vector<entry> > channels; // sorted by starttime
+    std::map<std::string,bloom> blooms; // eiteventids and titles per channel
+    std::map<uint64_t,time_t> misses; // events without xmltv data -> expiry
+    std::set<std::string> dirty;
+    bool loaded;
+    bool soundex;
+    int generation;
+    cMutex mutex;
+    uint64_t soundexhash(const char *Title);
+    void insert(std::vector<entry> &Events, const entry &Entry);
+    void addbloom(const std::string &ChannelID, const entry &Entry);
+    uint64_t misskey(const char *ChannelID, const cEvent *Event);
+    bool load(sqlite3 *Db);
+public:
+    cXMLTVCache();
+    void SetSoundEx(bool Value)
+    {
+        soundex=Value;
+    }
+    void Clear();
+    void Invalidate(const char *ChannelID);
+    int Generation()
+    {
+        return generation;
+    }
+    void Add(const char *ChannelID, time_t StartTime, tEventID EITEventID, int SrcIdx,
+             const char *Title, sqlite3_int64 RowID);
+    void SetEITEventID(const char *ChannelID, sqlite3_int64 RowID, tEventID EITEventID);
+    sqlite3_int64 Lookup(sqlite3 *Db, const char *ChannelID, const cEvent *Event, int TimeDiff);
+    bool KnownMiss(const char *ChannelID, const cEvent *Event);
+    void AddMiss(const char *ChannelID, const cEvent *Event);
+    void ClearMisses();
+};
+
+#endif
@@ -0,0 +1,294 @@
+/*
+ * compress.cpp: A plugin for the Video Disk Recorder
+ *
+ * See the README file for copyright information and how to reach the author.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#ifdef USE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+#include "compress.h"
+#include "xmltv2vdr.h"
+#include "debug.h"
+
+#ifdef USE_ZSTD
+
+#define MAXDICTS 8
+
+// dictionaries are never freed, other threads may still use them
+static cMutex dictmutex;
+static struct dictionary
+{
+    unsigned id;
+    ZSTD_CDict *cdict;
+    ZSTD_DDict *ddict;
+} dicts[MAXDICTS];
+static std::atomic<int> numdicts(0);
+static std::atomic<int> current(-1); // dictionary used for writing
+static size_t failedsamples=0; // samples of the last failed training, parser thread only
+
+// one context pair per thread, freed when the thread ends
+static thread_local struct contexts
+{
+    ZSTD_CCtx *c;
+    ZSTD_DCtx *d;
+    ~contexts()
+    {
+        if (c) ZSTD_freeCCtx(c);
+        if (d) ZSTD_freeDCtx(d);
+    }
+} ctx= { NULL, NULL };
+
+static const dictionary *getdict(unsigned Id)
+{
+    int cnt=numdicts;
+    for (int i=0; i<cnt; i++)
+    {
+        if (dicts[i].id==Id) return &dicts[i];
+    }
+    return NULL;
+}
+
+#endif
+
+bool cXMLTVCompressor::Enabled()
+{
+#ifdef USE_ZSTD
+    return true;
+#else
+    return false;
+#endif
+}
+
+void cXMLTVCompressor::Attach(sqlite3 *Db)
+{
+#ifdef USE_ZSTD
+    if (!Db) return;
+    // the dictionary of this database, other files may have another one
+    sqlite3_stmt *stmt=NULL;
+    if (sqlite3_prepare_v2(Db,"select dictid,dict from dictionary order by dictid desc limit 1;",-1,
+                           &stmt,NULL)!=SQLITE_OK)
+    {
+        current=-1;
+        return;
+    }
+    if (sqlite3_step(stmt)!=SQLITE_ROW)
+    {
+        sqlite3_finalize(stmt);
+        current=-1;
+        return;
+    }
+    unsigned id=(unsigned) sqlite3_column_int64(stmt,0);
+    cMutexLock lock(&dictmutex);
+    for (int i=0; i<numdicts; i++)
+    {
+        if (dicts[i].id==id)
+        {
+            current=i;
+            sqlite3_finalize(stmt);
+            return;
+        }
+    }
+    if (numdicts>=MAXDICTS)
+    {
+        sqlite3_finalize(stmt);
+        current=-1;
+        return;
+    }
+    const void *dict=sqlite3_column_blob(stmt,1);
+    int size=sqlite3_column_bytes(stmt,1);
+    ZSTD_CDict *cdict=dict ? ZSTD_createCDict(dict,size,3) : NULL;
+    ZSTD_DDict *ddict=dict ? ZSTD_createDDict(dict,size) : NULL;
+    sqlite3_finalize(stmt);
+    if (!cdict || !ddict || (ZSTD_getDictID_fromDDict(ddict)!=id))
+    {
+        if (cdict) ZSTD_freeCDict(cdict);
+        if (ddict) ZSTD_freeDDict(ddict);
+        esyslog("invalid compression dictionary %u",id);
+        current=-1;
+        return;
+    }
+    int idx=numdicts;
+    dicts[idx].id=id;
+    dicts[idx].cdict=cdict;
+    dicts[idx].ddict=ddict;
+    numdicts=idx+1;
+    current=idx;
+#else
+    (void) Db;
+#endif
+}
+
+bool cXMLTVCompressor::store(sqlite3 *Db, const void *Dict, size_t Size)
+{
+#ifdef USE_ZSTD
+    sqlite3_stmt *stmt=NULL;
+    if (sqlite3_prepare_v2(Db,"insert or replace into dictionary (dictid,dict) values (?1,?2);",-1,
+                           &stmt,NULL)!=SQLITE_OK)
+    {
+        esyslog("sqlite3: %s",sqlite3_errmsg(Db));
+        return false;
+    }
+    sqlite3_bind_int64(stmt,1,ZDICT_getDictID(Dict,Size));
+    sqlite3_bind_blob(stmt,2,Dict,(int) Size,SQLITE_STATIC);
+    int ret=sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    if (ret!=SQLITE_DONE)
+    {
+        esyslog("sqlite3: %s",sqlite3_errmsg(Db));
+        return false;
+    }
+    return true;
+#else
+    (void) Db;
+    (void) Dict;
+    (void) Size;
+    return false;
+#endif
+}
+
+bool cXMLTVCompressor::Train(sqlite3 *Db)
+{
+#ifdef USE_ZSTD
+    if (!Db) return false;
+    if (current>=0) return true;
+
+    // samples from all large columns, the first import is stored uncompressed
+    sqlite3_stmt *stmt=NULL;
+    char *sql;
+    if (asprintf(&sql,"select description from epg where typeof(description)='text' union all " \
+                 "select credits from epg where typeof(credits)='text' union all " \
+                 "select review from epg where typeof(review)='text' limit %i;",SAMPLES)==-1) return false;
+    int ret=sqlite3_prepare_v2(Db,sql,-1,&stmt,NULL);
+    free(sql);
+    if (ret!=SQLITE_OK) return false;
+
+    std::vector<char> samples;
+    std::vector<size_t> sizes;
+    while (sqlite3_step(stmt)==SQLITE_ROW)
+    {
+        const char *text=(const char *) sqlite3_column_text(stmt,0);
+        int len=sqlite3_column_bytes(stmt,0);
+        if (!text || (len<MINSIZE)) continue;
+        samples.insert(samples.end(),text,text+len);
+        sizes.push_back(len);
+    }
+    sqlite3_finalize(stmt);
+    if (sizes.size()<(SAMPLES/4)) return false; // not enough data yet
+    // the same samples would fail again, wait for more data
+    if (sizes.size()<=failedsamples) return false;
+
+    void *dict=malloc(DICTSIZE);
+    if (!dict) return false;
+    size_t size=ZDICT_trainFromBuffer(dict,DICTSIZE,&samples[0],&sizes[0],(unsigned) sizes.size());
+    if (ZDICT_isError(size))
+    {
+        esyslog("failed to train compression dictionary from %i values: %s",(int) sizes.size(),
+                ZDICT_getErrorName(size));
+        failedsamples=sizes.size();
+        free(dict);
+        return false;
+    }
+    bool ok=(sqlite3_exec(Db,"CREATE TABLE IF NOT EXISTS dictionary (dictid integer primary key, dict blob);",
+                          NULL,NULL,NULL)==SQLITE_OK) && store(Db,dict,size);
+    free(dict);
+    if (!ok) return false;
+    isyslog("trained compression dictionary from %i values",(int) sizes.size());
+    Attach(Db);
+    return true;
+#else
+    (void) Db;
+    return false;
+#endif
+}
+
+void *cXMLTVCompressor::Compress(const char *Text, int &Size)
+{
+#ifdef USE_ZSTD
+    if (!Text) return NULL;
+    int idx=current;
+    if (idx<0) return NULL;
+    size_t len=strlen(Text);
+    if (len<MINSIZE) return NULL;
+    if (!ctx.c) ctx.c=ZSTD_createCCtx();
+    if (!ctx.c) return NULL;
+    size_t bound=ZSTD_compressBound(len);
+    void *buf=malloc(bound);
+    if (!buf) return NULL;
+    size_t ret=ZSTD_compress_usingCDict(ctx.c,buf,bound,Text,len,dicts[idx].cdict);
+    if (ZSTD_isError(ret) || (ret>=len))
+    {
+        free(buf);
+        return NULL;
+    }
+    Size=(int) ret;
+    return buf;
+#else
+    (void) Text;
+    (void) Size;
+    return NULL;
+#endif
+}
+
+char *cXMLTVCompressor::Decompress(const void *Data, int Size)
+{
+#ifdef USE_ZSTD
+    if (!Data || (Size<=0)) return NULL;
+    unsigned long long len=ZSTD_getFrameContentSize(Data,Size);
+    if ((len==ZSTD_CONTENTSIZE_UNKNOWN) || (len==ZSTD_CONTENTSIZE_ERROR)) return NULL;
+    unsigned id=ZSTD_getDictID_fromFrame(Data,Size);
+    const dictionary *dict=NULL;
+    if (id)
+    {
+        dict=getdict(id);
+        if (!dict)
+        {
+            esyslog("missing compression dictionary %u",id);
+            return NULL;
+        }
+    }
+    if (!ctx.d) ctx.d=ZSTD_createDCtx();
+    if (!ctx.d) return NULL;
+    char *text=(char *) malloc(len+1);
+    if (!text) return NULL;
+    size_t ret=dict ? ZSTD_decompress_usingDDict(ctx.d,text,len,Data,Size,dict->ddict) :
+               ZSTD_decompressDCtx(ctx.d,text,len,Data,Size);
+    if (ZSTD_isError(ret))
+    {
+        free(text);
+        return NULL;
+    }
+    text[ret]=0;
+    return text;
+#else
+    (void) Data;
+    (void) Size;
+    return NULL;
+#endif
+}
+
+int cXMLTVCompressor::Bind(sqlite3_stmt *Stmt, int Index, const char *Text)
+{
+    if (!Text) return sqlite3_bind_null(Stmt,Index);
+    int size;
+    void *data=Compress(Text,size);
+    if (data) return sqlite3_bind_blob(Stmt,Index,data,size,free);
+    return sqlite3_bind_text(Stmt,Index,Text,-1,SQLITE_TRANSIENT);
+}
+
+char *cXMLTVCompressor::ColumnText(sqlite3_stmt *Stmt, int Col)
+{
+    if (sqlite3_column_type(Stmt,Col)==SQLITE_BLOB)
+    {
+        return Decompress(sqlite3_column_blob(Stmt,Col),sqlite3_column_bytes(Stmt,Col));
+    }
+    const char *text=(const char *) sqlite3_column_text(Stmt,Col);
+    return text ? strdup(text) : NULL;
+}
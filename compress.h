@@ -0,0 +1,40 @@
+/*
+ * compress.h: A plugin for the Video Disk Recorder
+ *
+ * See the README file for copyright information and how to reach the author.
+ *
+ */
+
+#ifndef _COMPRESS_H
+#define _COMPRESS_H
+
+#include <sqlite3.h>
+#include <stddef.h>
+
+// optional zstd compression of the large text columns (make USE_ZSTD=1).
+// Compressed values are stored as blobs, text values are read unchanged,
+// so a database may hold both. The dictionary is trained from the stored
+// descriptions and kept in the dictionary table of epg.db.
+class cXMLTVCompressor
+{
+private:
+    enum
+    {
+        MINSIZE=64,
+        DICTSIZE=65536,
+        SAMPLES=4000
+    };
+    static bool store(sqlite3 *Db, const void *Dict, size_t Size);
+public:
+    static bool Enabled();
+    static void Attach(sqlite3 *Db);
+    static bool Train(sqlite3 *Db);
+    // returns malloc'ed data or NULL if Text should be stored as is
+    static void *Compress(const char *Text, int &Size);
+    // returns malloc'ed text or NULL
+    static char *Decompress(const void *Data, int Size);
+    static int Bind(sqlite3_stmt *Stmt, int Index, const char *Text);
+    static char *ColumnText(sqlite3_stmt *Stmt, int Col);
+};
+
+#endif
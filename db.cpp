@@ -0,0 +1,336 @@
+/*
+ * db.cpp: A plugin for the Video Disk Recorder
+ *
+ * See the README file for copyright information and how to reach the author.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "xmltv2vdr.h"
+#include "debug.h"
+
+#define BUSYTIMEOUT 5000
+
+bool cEPGDatabase::pragma(sqlite3 *Db, const char *SQL)
+{
+    char *errmsg;
+    if (sqlite3_exec(Db,SQL,NULL,NULL,&errmsg)!=SQLITE_OK)
+    {
+        esyslog("sqlite3: %s -> %s",SQL,errmsg);
+        sqlite3_free(errmsg);
+        return false;
+    }
+    return true;
+}
+
+bool cEPGDatabase::hascolumn(sqlite3 *Db, const char *Table, const char *Column)
+{
+    char *sql;
+    if (asprintf(&sql,"select %s from %s limit 0;",Column,Table)==-1) return true;
+    sqlite3_stmt *stmt=NULL;
+    int ret=sqlite3_prepare_v2(Db,sql,-1,&stmt,NULL);
+    free(sql);
+    if (stmt) sqlite3_finalize(stmt);
+    if (ret==SQLITE_OK) return true;
+    // no epg table yet -> the parser creates it with all columns
+    const char *errmsg=sqlite3_errmsg(Db);
+    return (!errmsg || !strstr(errmsg,"no such column"));
+}
+
+int cEPGDatabase::IntValue(sqlite3 *Db, const char *SQL)
+{
+    int ret=-1;
+    sqlite3_stmt *stmt=NULL;
+    if (sqlite3_prepare_v2(Db,SQL,-1,&stmt,NULL)!=SQLITE_OK) return -1;
+    if (sqlite3_step(stmt)==SQLITE_ROW) ret=sqlite3_column_int(stmt,0);
+    sqlite3_finalize(stmt);
+    return ret;
+}
+
+static void soundexfunc(sqlite3_context *ctx, int UNUSED(argc), sqlite3_value **argv)
+{
+    char wstr[128];
+    const char *title=(const char *) sqlite3_value_text(argv[0]);
+    if (title && cImport::SoundEx(wstr,(char *) title,0,1))
+    {
+        sqlite3_result_text(ctx,wstr,-1,SQLITE_TRANSIENT);
+    }
+    else
+    {
+        sqlite3_result_null(ctx);
+    }
+}
+
+static void hashfunc(sqlite3_context *ctx, int UNUSED(argc), sqlite3_value **argv)
+{
+    // compressed values are hashed as they are stored
+    const unsigned char *data=(const unsigned char *) sqlite3_value_blob(argv[0]);
+    int size=sqlite3_value_bytes(argv[0]);
+    uint64_t hash=HashStr(NULL);
+    if (data)
+    {
+        hash=HASH_INIT;
+        for (int i=0; i<size; i++)
+        {
+            hash^=data[i];
+            hash*=0x100000001b3ULL;
+        }
+    }
+    sqlite3_result_int64(ctx,(sqlite3_int64) hash);
+}
+
+// uncompressed text of a large column, used by the full text triggers
+static void textfunc(sqlite3_context *ctx, int UNUSED(argc), sqlite3_value **argv)
+{
+    if (sqlite3_value_type(argv[0])!=SQLITE_BLOB)
+    {
+        sqlite3_result_value(ctx,argv[0]);
+        return;
+    }
+    char *text=cXMLTVCompressor::Decompress(sqlite3_value_blob(argv[0]),sqlite3_value_bytes(argv[0]));
+    if (text)
+    {
+        sqlite3_result_text(ctx,text,-1,free);
+    }
+    else
+    {
+        sqlite3_result_null(ctx);
+    }
+}
+
+// schema history, databases without user_version may already have some of the columns
+static const struct migration
+{
+    int version;
+    const char *table;
+    const char *column;
+    const char *add;
+    const char *sql;
+} migrations[]=
+{
+    {
+        1,"epg","datahash","ALTER TABLE epg ADD COLUMN datahash int;",
+        "CREATE TABLE IF NOT EXISTS watermarks (src nvarchar(100), channelid nvarchar(255), modified int, " \
+        "PRIMARY KEY(src, channelid));"
+    },
+    {
+        2,"epg","soundex_title","ALTER TABLE epg ADD COLUMN soundex_title nvarchar(10);" \
+        "UPDATE epg SET soundex_title=xmltv_soundex(title);",
+        "CREATE INDEX IF NOT EXISTS idx4 on epg (channelid, soundex_title, starttime);"
+    },
+    {
+        3,"epg","endtime","ALTER TABLE epg ADD COLUMN endtime int;" \
+        "UPDATE epg SET endtime=starttime+duration;",
+        "CREATE INDEX IF NOT EXISTS idx5 on epg (src, channelid, starttime);" \
+        "CREATE INDEX IF NOT EXISTS idx6 on epg (endtime);"
+    },
+    {
+        4,"watermarks","applied","ALTER TABLE watermarks ADD COLUMN applied int;" \
+        "ALTER TABLE watermarks ADD COLUMN appliedend int;",""
+    },
+    {
+        // the table is rebuilt with the old rowids, the full text index is recreated by fts().
+        // One-time cost: the whole epg table is copied under the write lock, so this only
+        // runs from Start() and the parser (see Migrate), readers in WAL mode are not blocked
+        5,"epg","id","DROP TRIGGER IF EXISTS epgfts_ai; DROP TRIGGER IF EXISTS epgfts_ad; " \
+        "DROP TRIGGER IF EXISTS epgfts_au; DROP TABLE IF EXISTS epgfts;" \
+        "CREATE TABLE epg_new (" EPG_COLUMNS ");" \
+        "INSERT INTO epg_new (id,src,channelid,eventid,eiteventid,starttime,duration,title,alttitle," \
+        "origtitle,shorttext,description,eitdescription,country,year,credits,category,review,rating," \
+        "starrating,video,audio,season,episode,episodeoverall,pics,srcidx,datahash,soundex_title,endtime) " \
+        "SELECT rowid,src,channelid,eventid,eiteventid,starttime,duration,title,alttitle," \
+        "origtitle,shorttext,description,eitdescription,country,year,credits,category,review,rating," \
+        "starrating,video,audio,season,episode,episodeoverall,pics,srcidx,datahash,soundex_title,endtime " \
+        "FROM epg;" \
+        "DROP TABLE epg;" \
+        "ALTER TABLE epg_new RENAME TO epg;",
+        EPG_INDEXES
+    },
+    {
+        6,"watermarks","setup","ALTER TABLE watermarks ADD COLUMN setup int;",""
+    }
+};
+
+#define SCHEMAVERSION ((int) (sizeof(migrations)/sizeof(migrations[0])))
+
+bool cEPGDatabase::migrate(sqlite3 *Db)
+{
+    if (IntValue(Db,"PRAGMA user_version;")>=SCHEMAVERSION) return true;
+    // no epg table yet -> the parser creates it with all columns
+    if (IntValue(Db,"select count(*) from sqlite_master where type='table' and name='epg';")<=0) return true;
+
+    // lock first, another thread may migrate at the same time
+    if (!pragma(Db,"BEGIN IMMEDIATE;")) return false;
+    int version=IntValue(Db,"PRAGMA user_version;");
+    if (version>=SCHEMAVERSION)
+    {
+        pragma(Db,"COMMIT;");
+        return true;
+    }
+    sqlite3_create_function(Db,"xmltv_soundex",1,SQLITE_UTF8,NULL,soundexfunc,NULL,NULL);
+
+    for (int i=0; i<SCHEMAVERSION; i++)
+    {
+        if (migrations[i].version<=version) continue;
+        isyslog("migrating epg.db to version %i%s",migrations[i].version,
+                (migrations[i].version==5) ? ", copying all events once" : "");
+        if (!hascolumn(Db,migrations[i].table,migrations[i].column) && !pragma(Db,migrations[i].add))
+        {
+            pragma(Db,"ROLLBACK;");
+            return false;
+        }
+        if (!pragma(Db,migrations[i].sql))
+        {
+            pragma(Db,"ROLLBACK;");
+            return false;
+        }
+    }
+
+    char *sql;
+    if (asprintf(&sql,"PRAGMA user_version=%i;",SCHEMAVERSION)==-1)
+    {
+        pragma(Db,"ROLLBACK;");
+        return false;
+    }
+    bool ret=pragma(Db,sql);
+    free(sql);
+    if (!ret)
+    {
+        pragma(Db,"ROLLBACK;");
+        return false;
+    }
+    return pragma(Db,"COMMIT;");
+}
+
+bool cEPGDatabase::fulltext=false;
+
+// external content table, the triggers keep it in sync with every write to epg
+#define FTS_CREATE "CREATE VIRTUAL TABLE epgfts USING fts5(title, shorttext, description, " \
+                   "content='epg', content_rowid='rowid');" \
+                   "CREATE TRIGGER epgfts_ai AFTER INSERT ON epg BEGIN " \
+                   "INSERT INTO epgfts(rowid,title,shorttext,description) VALUES " \
+                   "(new.rowid,new.title,new.shorttext,xmltv_text(new.description)); END;" \
+                   "CREATE TRIGGER epgfts_ad AFTER DELETE ON epg BEGIN " \
+                   "INSERT INTO epgfts(epgfts,rowid,title,shorttext,description) VALUES " \
+                   "('delete',old.rowid,old.title,old.shorttext,xmltv_text(old.description)); END;" \
+                   "CREATE TRIGGER epgfts_au AFTER UPDATE OF title,shorttext,description ON epg BEGIN " \
+                   "INSERT INTO epgfts(epgfts,rowid,title,shorttext,description) VALUES " \
+                   "('delete',old.rowid,old.title,old.shorttext,xmltv_text(old.description)); " \
+                   "INSERT INTO epgfts(rowid,title,shorttext,description) VALUES " \
+                   "(new.rowid,new.title,new.shorttext,xmltv_text(new.description)); END;" \
+                   "INSERT INTO epgfts(rowid,title,shorttext,description) " \
+                   "SELECT rowid,title,shorttext,xmltv_text(description) FROM epg;"
+
+#define FTS_DROP "DROP TRIGGER IF EXISTS epgfts_ai; DROP TRIGGER IF EXISTS epgfts_ad; " \
+                 "DROP TRIGGER IF EXISTS epgfts_au; DROP TABLE IF EXISTS epgfts;"
+
+bool cEPGDatabase::fts(sqlite3 *Db)
+{
+    const char *exists="select count(*) from sqlite_master where name='epgfts';";
+    int have=IntValue(Db,exists);
+    if (have<0) return false;
+    if ((have>0)==fulltext) return true;
+    if (fulltext)
+    {
+        // wait for the parser to create epg
+        if (IntValue(Db,"select count(*) from sqlite_master where type='table' and name='epg';")<=0) return true;
+        if (!sqlite3_compileoption_used("ENABLE_FTS5"))
+        {
+            esyslog("sqlite3 without FTS5, no full text search");
+            fulltext=false;
+            return false;
+        }
+    }
+
+    if (!pragma(Db,"BEGIN IMMEDIATE;")) return false;
+    have=IntValue(Db,exists);
+    if ((have>0)!=fulltext)
+    {
+        if (fulltext) isyslog("creating full text index");
+        if (!pragma(Db,fulltext ? FTS_CREATE : FTS_DROP))
+        {
+            pragma(Db,"ROLLBACK;");
+            return false;
+        }
+    }
+    return pragma(Db,"COMMIT;");
+}
+
+int cEPGDatabase::SchemaVersion()
+{
+    return SCHEMAVERSION;
+}
+
+bool cEPGDatabase::Migrate(sqlite3 *Db)
+{
+    // called from Start() and the parser, never from the EIT thread
+    if (!migrate(Db)) return false;
+    fts(Db);
+    return true;
+}
+
+sqlite3 *cEPGDatabase::Open(const char *File, int Flags)
+{
+    if (!File) return NULL;
+    sqlite3 *db=NULL;
+    if (sqlite3_open_v2(File,&db,Flags,NULL)!=SQLITE_OK)
+    {
+        if (db) sqlite3_close(db);
+        return NULL;
+    }
+    sqlite3_busy_timeout(db,BUSYTIMEOUT);
+    sqlite3_create_function(db,"xmltv_hash",1,SQLITE_UTF8|SQLITE_DETERMINISTIC,NULL,hashfunc,NULL,NULL);
+    sqlite3_create_function(db,"xmltv_text",1,SQLITE_UTF8|SQLITE_DETERMINISTIC,NULL,textfunc,NULL,NULL);
+    // only takes effect on a new, empty database
+    if ((Flags & SQLITE_OPEN_CREATE)!=0) pragma(db,"PRAGMA auto_vacuum=INCREMENTAL;");
+
+    // journal mode is stored in the database, this only converts old files
+    if ((Flags & SQLITE_OPEN_READONLY)==0) pragma(db,"PRAGMA journal_mode=WAL;");
+    cXMLTVCompressor::Attach(db);
+    // NORMAL is safe in WAL mode, only the last commits may get lost on power failure
+    pragma(db,"PRAGMA synchronous=NORMAL;"
+           "PRAGMA cache_size=-8192;"
+           "PRAGMA mmap_size=67108864;"
+           "PRAGMA temp_store=MEMORY;");
+    return db;
+}
+
+void cEPGDatabase::Close(sqlite3 *Db)
+{
+    if (!Db) return;
+    if (sqlite3_close(Db)!=SQLITE_OK)
+    {
+        esyslog("sqlite3: %s (close)",sqlite3_errmsg(Db));
+        sqlite3_close_v2(Db);
+    }
+}
+
+bool cEPGDatabase::Unlink(const char *File)
+{
+    if (!File) return false;
+    bool ret=(unlink(File)==0);
+    UnlinkWAL(File);
+    return ret;
+}
+
+void cEPGDatabase::UnlinkWAL(const char *File)
+{
+    // a WAL left over from another database must never be applied to this one
+    if (!File) return;
+    char *name;
+    if (asprintf(&name,"%s-wal",File)!=-1)
+    {
+        unlink(name);
+        free(name);
+    }
+    if (asprintf(&name,"%s-shm",File)!=-1)
+    {
+        unlink(name);
+        free(name);
+    }
+}
@@ -0,0 +1,71 @@
+/*
+ * db.h: A plugin for the Video Disk Recorder
+ *
+ * See the README file for copyright information and how to reach the author.
+ *
+ */
+
+#ifndef _DB_H
+#define _DB_H
+
+#include <sqlite3.h>
+
+// id is the rowid, an explicit INTEGER PRIMARY KEY keeps it stable across VACUUM
+#define EPG_COLUMNS "id integer primary key autoincrement, " \
+                    "src nvarchar(100), channelid nvarchar(255), eventid int, eiteventid int, " \
+                    "starttime datetime, duration int, title nvarchar(255), alttitle nvarchar(255), " \
+                    "origtitle nvarchar(255), shorttext nvarchar(255), description text, " \
+                    "eitdescription text, country nvarchar(255), year int, " \
+                    "credits text, category text, review text, rating text, " \
+                    "starrating text, video text, audio text, season int, episode int, " \
+                    "episodeoverall int, pics text, srcidx int, datahash int, soundex_title nvarchar(10), " \
+                    "endtime int, UNIQUE(eventid, src, channelid)"
+
+#define EPG_INDEXES "CREATE INDEX IF NOT EXISTS idx1 on epg (starttime, eiteventid, channelid); " \
+                    "CREATE INDEX IF NOT EXISTS idx2 on epg (starttime, title, channelid); " \
+                    "CREATE INDEX IF NOT EXISTS idx3 on epg (starttime, duration, src); " \
+                    "CREATE INDEX IF NOT EXISTS idx4 on epg (channelid, soundex_title, starttime); " \
+                    "CREATE INDEX IF NOT EXISTS idx5 on epg (src, channelid, starttime); " \
+                    "CREATE INDEX IF NOT EXISTS idx6 on epg (endtime); "
+
+// all connections to epg.db are opened here, every thread uses its own
+// connection. In WAL mode readers never block the writer and vice versa.
+// There is no dispatching writer thread: sqlite allows one write transaction
+// at a time, the busy timeout queues concurrent writers inside sqlite. The
+// EIT handler writes through cXMLTVWriter, parser and import keep their
+// transactions short (see PARSE_CHUNK).
+class cEPGDatabase
+{
+private:
+    static bool pragma(sqlite3 *Db, const char *SQL);
+    static bool hascolumn(sqlite3 *Db, const char *Table, const char *Column);
+    static bool migrate(sqlite3 *Db);
+    static bool fulltext;
+    static bool fts(sqlite3 *Db);
+public:
+    static void SetFullText(bool FullText)
+    {
+        fulltext=FullText;
+    }
+    static bool FullText()
+    {
+        return fulltext;
+    }
+    static int IntValue(sqlite3 *Db, const char *SQL);
+    static int SchemaVersion();
+    static bool Migrate(sqlite3 *Db);
+    static sqlite3 *Open(const char *File, int Flags=SQLITE_OPEN_READWRITE);
+    static void Close(sqlite3 *Db);
+    static int AutoVacuum(sqlite3 *Db)
+    {
+        return IntValue(Db,"PRAGMA auto_vacuum;");
+    }
+    static int FreePages(sqlite3 *Db)
+    {
+        return IntValue(Db,"PRAGMA freelist_count;");
+    }
+    static bool Unlink(const char *File);
+    static void UnlinkWAL(const char *File);
+};
+
+#endif
@@ -8,9 +8,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <vector>
-#include <regex>
 #include <vdr/tools.h>
 #include "event.h"
+#include "import.h"
+#include "compress.h"
 
 extern char *strcatrealloc(char *, const char*);
 
@@ -42,6 +43,15 @@ const char* cXMLTVStringList::toString()
     return buf;
 }
 
+uint64_t cXMLTVStringList::Hash(uint64_t hash)
+{
+    for (int i=0; i<Size();i++)
+    {
+        hash=HashStr(operator[](i),hash);
+    }
+    return HashInt(Size(),hash);
+}
+
 // -------------------------------------------------------------
 
 char* cXMLTVEvent::removechar(char* s, char what)
@@ -451,98 +461,118 @@ void cXMLTVEvent::CreateEventID(time_t StartTime)
     weakid=true;
 }
 
-void cXMLTVEvent::GetSQL(const char *Source, int SrcIdx, const char *ChannelID, char **Insert, char **Update)
-{
-    if (sql_insert)
-    {
-        free(sql_insert);
-        sql_insert=NULL;
-    }
-    if (sql_update)
-    {
-        free(sql_update);
-        sql_update=NULL;
-    }
-
-    if (!Insert) return;
-    if (!Update) return;
-
-    *Insert=NULL;
-    *Update=NULL;
-
-    const char *cr=credits.toString();
-    const char *ca=category.toString();
-    const char *re=review.toString();
-    const char *ra=rating.toString();
-    const char *sr=starrating.toString();
-    const char *vi=video.toString();
-    const char *pi=pics.toString();
-
-    if (!eventid) return;
-
-    if (asprintf(&sql_insert,
-                 "INSERT OR FAIL INTO epg (src,channelid,eventid,starttime,duration,"\
-                 "title,alttitle,origtitle,shorttext,description,country,year,credits,category,"\
-                 "review,rating,starrating,video,audio,season,episode,episodeoverall,pics,srcidx) "\
-                 "VALUES (^%s^,^%s^,%u,%li,%i,"\
-                 "^%s^,^%s^,^%s^,^%s^,^%s^,^%s^,%i,^%s^,^%s^,"\
-                 "^%s^,^%s^,^%s^,^%s^,^%s^,%i,%i,%i,^%s^,%i);"
-                 ,
-                 Source,ChannelID,eventid,starttime,duration,title,
-                 alttitle ? alttitle : "NULL",
-                 origtitle ? origtitle : "NULL",
-                 shorttext ? shorttext : "NULL",
-                 description ? description : "NULL",
-                 country ? country : "NULL",
-                 year,
-                 cr,ca,re,ra,sr,vi,
-                 audio ? audio : "NULL",
-                 season, episode, episodeoverall, pi, SrcIdx
-                )==-1)
-    {
-        sql_insert=NULL;
-        return;
-    }
-
-    if (asprintf(&sql_update,
-                 "UPDATE epg SET duration=%i,starttime=%li,title=^%s^,alttitle=^%s^,origtitle=^%s^,"\
-                 "shorttext=^%s^,description=^%s^,country=^%s^,year=%i,credits=^%s^,category=^%s^,"\
-                 "review=^%s^,rating=^%s^,starrating=^%s^,video=^%s^,audio=^%s^,season=%i,episode=%i, "\
-                 "episodeoverall=%i,pics=^%s^,srcidx=%i " \
-                 " where src=^%s^ and channelid=^%s^ and eventid=%u"
-                 ,
-                 duration,starttime,title,
-                 alttitle ? alttitle : "NULL",
-                 origtitle ? origtitle : "NULL",
-                 shorttext ? shorttext : "NULL",
-                 description ? description : "NULL",
-                 country ? country : "NULL",
-                 year,
-                 cr,ca,re,ra,sr,vi,
-                 audio ? audio : "NULL",
-                 season, episode, episodeoverall, pi, SrcIdx,
-                 Source,ChannelID,eventid
-                )==-1)
-    {
-        sql_update=NULL;
-        return;
-    }
-
-    std::string si=sql_insert;
-    si = std::regex_replace(si, std::regex("'"), "''");
-    si = std::regex_replace(si, std::regex("\\^"), "'");
-    si = std::regex_replace(si, std::regex("'NULL'"), "NULL");
-    sql_insert=(char *) realloc(sql_insert,si.size()+1);
-    strcpy(sql_insert,si.c_str());
-    *Insert=sql_insert;
-
-    std::string su=sql_update;
-    su = std::regex_replace(su, std::regex("'"), "''");
-    su = std::regex_replace(su, std::regex("\\^"), "'");
-    su = std::regex_replace(su, std::regex("'NULL'"), "NULL");
-    sql_update=(char *) realloc(sql_update,su.size()+1);
-    strcpy(sql_update,su.c_str());
-    *Update=sql_update;
+uint64_t cXMLTVEvent::Hash()
+{
+    uint64_t hash=HashStr(title);
+    hash=HashStr(alttitle,hash);
+    hash=HashStr(origtitle,hash);
+    hash=HashStr(shorttext,hash);
+    hash=HashStr(description,hash);
+    hash=HashStr(eitdescription,hash);
+    hash=HashStr(country,hash);
+    hash=HashStr(audio,hash);
+    hash=HashInt(starttime,hash);
+    hash=HashInt(duration,hash);
+    hash=HashInt(year,hash);
+    hash=HashInt(season,hash);
+    hash=HashInt(episode,hash);
+    hash=HashInt(episodeoverall,hash);
+    hash=HashInt(eiteventid,hash);
+    hash=video.Hash(hash);
+    hash=credits.Hash(hash);
+    hash=category.Hash(hash);
+    hash=review.Hash(hash);
+    hash=rating.Hash(hash);
+    hash=starrating.Hash(hash);
+    hash=pics.Hash(hash);
+    return hash;
+}
+
+const char cXMLTVEvent::InsertSQL[]=
+    "INSERT OR FAIL INTO epg (src,channelid,eventid,starttime,duration,"\
+    "title,alttitle,origtitle,shorttext,description,country,year,credits,category,"\
+    "review,rating,starrating,video,audio,season,episode,episodeoverall,pics,srcidx,datahash,"\
+    "soundex_title,endtime) "\
+    "VALUES (:src,:channelid,:eventid,:starttime,:duration,"\
+    ":title,:alttitle,:origtitle,:shorttext,:description,:country,:year,:credits,:category,"\
+    ":review,:rating,:starrating,:video,:audio,:season,:episode,:episodeoverall,:pics,:srcidx,:datahash,"\
+    ":soundex_title,:starttime+:duration);";
+
+// unchanged rows are not updated, so the parser can tell which channels changed
+const char cXMLTVEvent::UpdateSQL[]=
+    "UPDATE epg SET duration=:duration,starttime=:starttime,title=:title,alttitle=:alttitle,"\
+    "origtitle=:origtitle,shorttext=:shorttext,description=:description,country=:country,year=:year,"\
+    "credits=:credits,category=:category,review=:review,rating=:rating,starrating=:starrating,"\
+    "video=:video,audio=:audio,season=:season,episode=:episode,episodeoverall=:episodeoverall,"\
+    "pics=:pics,srcidx=:srcidx,datahash=:datahash,soundex_title=:soundex_title,"\
+    "endtime=:starttime+:duration "\
+    "where src=:src and channelid=:channelid and eventid=:eventid and datahash is not :datahash;";
+
+static int bindtext(sqlite3_stmt *stmt, const char *name, const char *value)
+{
+    int idx=sqlite3_bind_parameter_index(stmt,name);
+    if (!idx) return SQLITE_OK;
+    if (!value) return sqlite3_bind_null(stmt,idx);
+    return sqlite3_bind_text(stmt,idx,value,-1,SQLITE_TRANSIENT);
+}
+
+static int bindlist(sqlite3_stmt *stmt, const char *name, cXMLTVStringList *value)
+{
+    return bindtext(stmt,name,value->Size() ? value->toString() : NULL);
+}
+
+// large text columns, stored compressed if enabled
+static int bindlarge(sqlite3_stmt *stmt, const char *name, const char *value)
+{
+    int idx=sqlite3_bind_parameter_index(stmt,name);
+    if (!idx) return SQLITE_OK;
+    return cXMLTVCompressor::Bind(stmt,idx,value);
+}
+
+static int bindint(sqlite3_stmt *stmt, const char *name, sqlite3_int64 value)
+{
+    int idx=sqlite3_bind_parameter_index(stmt,name);
+    if (!idx) return SQLITE_OK;
+    return sqlite3_bind_int64(stmt,idx,value);
+}
+
+bool cXMLTVEvent::Bind(sqlite3_stmt *Stmt, const char *Source, int SrcIdx, const char *ChannelID)
+{
+    if (!Stmt) return false;
+    if (!eventid) return false;
+
+    sqlite3_reset(Stmt);
+    sqlite3_clear_bindings(Stmt);
+
+    int ret=bindtext(Stmt,":src",Source);
+    if (ret==SQLITE_OK) ret=bindtext(Stmt,":channelid",ChannelID);
+    if (ret==SQLITE_OK) ret=bindint(Stmt,":eventid",eventid);
+    if (ret==SQLITE_OK) ret=bindint(Stmt,":starttime",starttime);
+    if (ret==SQLITE_OK) ret=bindint(Stmt,":duration",duration);
+    if (ret==SQLITE_OK) ret=bindtext(Stmt,":title",title);
+    if (ret==SQLITE_OK) ret=bindtext(Stmt,":alttitle",alttitle);
+    if (ret==SQLITE_OK) ret=bindtext(Stmt,":origtitle",origtitle);
+    if (ret==SQLITE_OK) ret=bindtext(Stmt,":shorttext",shorttext);
+    if (ret==SQLITE_OK) ret=bindlarge(Stmt,":description",description);
+    if (ret==SQLITE_OK) ret=bindtext(Stmt,":country",country);
+    if (ret==SQLITE_OK) ret=bindint(Stmt,":year",year);
+    if (ret==SQLITE_OK) ret=bindlarge(Stmt,":credits",credits.Size() ? credits.toString() : NULL);
+    if (ret==SQLITE_OK) ret=bindlist(Stmt,":category",&category);
+    if (ret==SQLITE_OK) ret=bindlarge(Stmt,":review",review.Size() ? review.toString() : NULL);
+    if (ret==SQLITE_OK) ret=bindlist(Stmt,":rating",&rating);
+    if (ret==SQLITE_OK) ret=bindlist(Stmt,":starrating",&starrating);
+    if (ret==SQLITE_OK) ret=bindlist(Stmt,":video",&video);
+    if (ret==SQLITE_OK) ret=bindtext(Stmt,":audio",audio);
+    if (ret==SQLITE_OK) ret=bindint(Stmt,":season",season);
+    if (ret==SQLITE_OK) ret=bindint(Stmt,":episode",episode);
+    if (ret==SQLITE_OK) ret=bindint(Stmt,":episodeoverall",episodeoverall);
+    if (ret==SQLITE_OK) ret=bindlist(Stmt,":pics",&pics);
+    if (ret==SQLITE_OK) ret=bindint(Stmt,":srcidx",SrcIdx);
+    if (ret==SQLITE_OK) ret=bindint(Stmt,":datahash",(sqlite3_int64) Hash());
+    char wstr[128];
+    if (ret==SQLITE_OK) ret=bindtext(Stmt,":soundex_title",
+                                         cImport::SoundEx(wstr,title,0,1) ? wstr : NULL);
+    return (ret==SQLITE_OK);
 }
 
 void cXMLTVEvent::Clear()
@@ -552,16 +582,6 @@ void cXMLTVEvent::Clear()
         free(source);
         source=NULL;
     }
-    if (sql_insert)
-    {
-        free(sql_insert);
-        sql_insert=NULL;
-    }
-    if (sql_update)
-    {
-        free(sql_update);
-        sql_update=NULL;
-    }
     if (title)
     {
         free(title);
@@ -611,6 +631,7 @@ void cXMLTVEvent::Clear()
     starttime=0;
     duration=0;
     eventid=eiteventid=0;
+    rowid=0;
     video.Clear();
     credits.Clear();
     category.Clear();
@@ -623,12 +644,11 @@ void cXMLTVEvent::Clear()
     episodeoverall=0;
     parentalRating=0;
     weakid=false;
+    partial=false;
 }
 
 cXMLTVEvent::cXMLTVEvent()
 {
-    sql_insert=NULL;
-    sql_update=NULL;
     source=NULL;
     channelid=NULL;
     title=NULL;
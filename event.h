@@ -9,8 +9,35 @@
 #define _EVENT_H
 
 #include <time.h>
+#include <stdint.h>
+#include <sqlite3.h>
 #include <vdr/epg.h>
 
+// 64-bit FNV-1a, used for change detection and lookup keys
+#define HASH_INIT 0xcbf29ce484222325ULL
+
+inline uint64_t HashStr(const char *s, uint64_t hash=HASH_INIT)
+{
+    if (!s) return (hash ^ 0xff) * 0x100000001b3ULL;
+    while (*s)
+    {
+        hash^=(unsigned char) *s++;
+        hash*=0x100000001b3ULL;
+    }
+    return (hash ^ 0xfe) * 0x100000001b3ULL;
+}
+
+inline uint64_t HashInt(uint64_t value, uint64_t hash=HASH_INIT)
+{
+    for (int i=0; i<8; i++)
+    {
+        hash^=(value & 0xff);
+        hash*=0x100000001b3ULL;
+        value>>=8;
+    }
+    return hash;
+}
+
 class cXMLTVStringList : public cVector<char *>
 {
 private:
@@ -26,6 +53,7 @@ public:
         cVector<char *>::Sort(CompareStrings);
     }
     const char *toString();
+    uint64_t Hash(uint64_t hash=HASH_INIT);
     virtual void Clear(void);
 };
 
@@ -40,8 +68,6 @@ private:
     char *country;
     char *origtitle;
     char *audio;
-    char *sql_insert;
-    char *sql_update;
     char *channelid;
     char *source;
     int year;
@@ -51,6 +77,8 @@ private:
     int episode;
     int episodeoverall;
     bool weakid;
+    bool partial;
+    long long rowid;
     tEventID eventid;
     tEventID eiteventid;
     cXMLTVStringList video;
@@ -92,11 +120,30 @@ public:
     void SetVideo(const char *Video);
     void SetPics(const char *Pics);
     void CreateEventID(time_t StartTime);
-    void GetSQL(const char *Source, int SrcIdx, const char *ChannelID, char **Insert, char **Update);
+    static const char InsertSQL[];
+    static const char UpdateSQL[];
+    bool Bind(sqlite3_stmt *Stmt, const char *Source, int SrcIdx, const char *ChannelID);
+    uint64_t Hash();
     bool WeakID()
     {
         return weakid;
     }
+    void SetRowID(long long RowID)
+    {
+        rowid=RowID;
+    }
+    void SetPartial(bool Partial)
+    {
+        partial=Partial;
+    }
+    bool Partial() const
+    {
+        return partial;
+    }
+    long long RowID() const
+    {
+        return rowid;
+    }
     cXMLTVStringList *Credits()
     {
         return &credits;
@@ -9,13 +9,14 @@
 #include <ctype.h>
 #include <time.h>
 #include <unistd.h>
+#include <dirent.h>
 #include <sys/types.h>
 #include <vdr/channels.h>
 
-#include <regex>
 
 #include "xmltv2vdr.h"
 #include "import.h"
+#include "writer.h"
 #include "event.h"
 #include "debug.h"
 
@@ -218,22 +219,53 @@ cEvent *cImport::SearchVDREvent(cEPGSource *source, cSchedule* schedule, cXMLTVE
                                  xevent->Duration(), hint);
 }
 
-cEvent *cImport::GetEventBefore(cSchedule* schedule, time_t start)
+void cScheduleIndex::Build(cSchedule *Schedule)
 {
-    if (!schedule) return NULL;
-    if (!schedule->Events()) return NULL;
-    if (!schedule->Events()->Count()) return NULL;
-    cEvent *last=(cEvent *) schedule->Events()->Last();
-    if ((last) && (last->StartTime()<start)) return last;
+    if (Schedule==schedule) return;
+    Flush();
+    schedule=Schedule;
+    if (!schedule || !schedule->Events()) return;
     for (cEvent *p=(cEvent *) schedule->Events()->First(); p; p=(cEvent *) schedule->Events()->Next(p))
     {
-        if (p->StartTime()>start)
-        {
-            return (cEvent *) p->Prev();
-        }
+        events.insert(std::make_pair(p->StartTime(),p));
     }
-    if (last) return last;
-    return NULL;
+}
+
+void cScheduleIndex::Flush()
+{
+    // appended events are sorted into the schedule just once
+    if (schedule && needsort) schedule->Sort();
+    needsort=false;
+    schedule=NULL;
+    events.clear();
+}
+
+void cScheduleIndex::Add(cEvent *Event)
+{
+    if (!schedule || !Event) return;
+    schedule->AddEvent(Event);
+    events.insert(std::make_pair(Event->StartTime(),Event));
+    needsort=true;
+}
+
+cEvent *cScheduleIndex::Predecessor(time_t Start, cEvent **Next)
+{
+    // last event starting at or before Start and the one following it
+    if (Next) *Next=NULL;
+    std::multimap<time_t,cEvent *>::iterator it=events.upper_bound(Start);
+    if (Next && (it!=events.end())) *Next=it->second;
+    if (it==events.begin()) return NULL;
+    --it;
+    return it->second;
+}
+
+bool cScheduleIndex::IsFree(time_t Start, time_t End)
+{
+    cEvent *next;
+    cEvent *prev=Predecessor(Start,&next);
+    if (prev && (prev->EndTime()>Start)) return false;
+    if (next && (next->StartTime()<End)) return false;
+    return true;
 }
 
 char *cImport::RemoveLastCharFromDescription(char *description)
@@ -435,328 +467,431 @@ void cImport::LinkPictures(const char *Source, cXMLTVStringList *Pics, tEventID
     }
 }
 
-char *cImport::Add2Description(char *description, cXMLTVEvent *xEvent, int Flags, int what)
+char *cImport::AddLongText2Description(char *description, cXMLTVEvent *xEvent, int Flags)
 {
-    if (what==USE_LONGTEXT)
+    bool lta=false;
+    if (((Flags & USE_LONGTEXT)==USE_LONGTEXT) || ((Flags & OPT_APPEND)==OPT_APPEND))
     {
-        bool lta=false;
-        if (((Flags & USE_LONGTEXT)==USE_LONGTEXT) || ((Flags & OPT_APPEND)==OPT_APPEND))
+        if (xEvent->Description() && (strlen(xEvent->Description())>0))
         {
-            if (xEvent->Description() && (strlen(xEvent->Description())>0))
-            {
-                description=Add2Description(description,xEvent->Description());
-                lta=true;
-            }
+            description=Add2Description(description,xEvent->Description());
+            lta=true;
         }
+    }
 
-        if (!lta && xEvent->EITDescription() && (strlen(xEvent->EITDescription())>0))
-        {
-            description=Add2Description(description,xEvent->EITDescription());
-        }
-        description=Add2Description(description,"\n");
+    if (!lta && xEvent->EITDescription() && (strlen(xEvent->EITDescription())>0))
+    {
+        description=Add2Description(description,xEvent->EITDescription());
     }
+    description=Add2Description(description,"\n");
+    return description;
+}
 
-    if ((what==USE_CREDITS) && ((Flags & USE_CREDITS)==USE_CREDITS))
+char *cImport::AddCredits2Description(char *description, cXMLTVEvent *xEvent, int Flags)
+{
+    cXMLTVStringList *credits=xEvent->Credits();
+    if (credits->Size())
     {
-        cXMLTVStringList *credits=xEvent->Credits();
-        if (credits->Size())
+        cTEXTMapping *oldtext=NULL;
+        for (int i=0; i<credits->Size(); i++)
         {
-            cTEXTMapping *oldtext=NULL;
-            for (int i=0; i<credits->Size(); i++)
+            char *ctype=strdup((*credits)[i]);
+            if (ctype)
             {
-                char *ctype=strdup((*credits)[i]);
-                if (ctype)
+                char *cval=strchr(ctype,'|');
+                if (cval)
                 {
-                    char *cval=strchr(ctype,'|');
-                    if (cval)
+                    *cval=0;
+                    cval++;
+                    bool add=true;
+                    if (((Flags & CREDITS_ACTORS)!=CREDITS_ACTORS) &&
+                            (!strcasecmp(ctype,"actor"))) add=false;
+                    if (((Flags & CREDITS_DIRECTORS)!=CREDITS_DIRECTORS) &&
+                            (!strcasecmp(ctype,"director"))) add=false;
+                    if (((Flags & CREDITS_OTHERS)!=CREDITS_OTHERS) &&
+                            (add) && (strcasecmp(ctype,"actor")) &&
+                            (strcasecmp(ctype,"director"))) add=false;
+                    if (add)
                     {
-                        *cval=0;
-                        cval++;
-                        bool add=true;
-                        if (((Flags & CREDITS_ACTORS)!=CREDITS_ACTORS) &&
-                                (!strcasecmp(ctype,"actor"))) add=false;
-                        if (((Flags & CREDITS_DIRECTORS)!=CREDITS_DIRECTORS) &&
-                                (!strcasecmp(ctype,"director"))) add=false;
-                        if (((Flags & CREDITS_OTHERS)!=CREDITS_OTHERS) &&
-                                (add) && (strcasecmp(ctype,"actor")) &&
-                                (strcasecmp(ctype,"director"))) add=false;
-                        if (add)
+                        cTEXTMapping *text=g->TEXTMappings()->GetMap(ctype);
+                        if ((Flags & CREDITS_LIST)==CREDITS_LIST)
                         {
-                            cTEXTMapping *text=g->TEXTMappings()->GetMap(ctype);
-                            if ((Flags & CREDITS_LIST)==CREDITS_LIST)
+                            if (oldtext!=text)
                             {
-                                if (oldtext!=text)
+                                if (oldtext)
                                 {
-                                    if (oldtext)
-                                    {
-                                        description=RemoveLastCharFromDescription(description);
-                                        description=RemoveLastCharFromDescription(description);
-                                        description=Add2Description(description,"\n");
-                                    }
-                                    description=Add2Description(description,text->Value());
-                                    description=Add2Description(description,": ");
+                                    description=RemoveLastCharFromDescription(description);
+                                    description=RemoveLastCharFromDescription(description);
+                                    description=Add2Description(description,"\n");
                                 }
-                                description=Add2Description(description,cval);
-                                description=Add2Description(description,", ");
+                                description=Add2Description(description,text->Value());
+                                description=Add2Description(description,": ");
                             }
-                            else
+                            description=Add2Description(description,cval);
+                            description=Add2Description(description,", ");
+                        }
+                        else
+                        {
+                            if (text)
                             {
-                                if (text)
-                                {
-                                    description=Add2Description(description,text->Value(),cval);
-                                }
+                                description=Add2Description(description,text->Value(),cval);
                             }
-                            oldtext=text;
                         }
+                        oldtext=text;
                     }
-                    free(ctype);
                 }
-            }
-            if ((oldtext) && ((Flags & CREDITS_LIST)==CREDITS_LIST))
-            {
-                description=RemoveLastCharFromDescription(description);
-                description=RemoveLastCharFromDescription(description);
-                description=Add2Description(description,"\n");
+                free(ctype);
             }
         }
-    }
-
-    if ((what==USE_COUNTRYDATE) && ((Flags & USE_COUNTRYDATE)==USE_COUNTRYDATE))
-    {
-        if (xEvent->Country())
+        if ((oldtext) && ((Flags & CREDITS_LIST)==CREDITS_LIST))
         {
-            cTEXTMapping *text=g->TEXTMappings()->GetMap("country");
-            if (text) description=Add2Description(description,text->Value(),xEvent->Country());
+            description=RemoveLastCharFromDescription(description);
+            description=RemoveLastCharFromDescription(description);
+            description=Add2Description(description,"\n");
         }
+    }
+    return description;
+}
 
-        if (xEvent->Year())
-        {
-            cTEXTMapping *text=g->TEXTMappings()->GetMap("year");
-            if (text) description=Add2Description(description,text->Value(),xEvent->Year());
-        }
+char *cImport::AddCountryDate2Description(char *description, cXMLTVEvent *xEvent, int UNUSED(Flags))
+{
+    if (xEvent->Country())
+    {
+        cTEXTMapping *text=g->TEXTMappings()->GetMap("country");
+        if (text) description=Add2Description(description,text->Value(),xEvent->Country());
     }
-    if ((what==USE_ORIGTITLE) && ((Flags & USE_ORIGTITLE)==USE_ORIGTITLE) &&
-            (xEvent->OrigTitle()))
+
+    if (xEvent->Year())
     {
-        cTEXTMapping *text=g->TEXTMappings()->GetMap("originaltitle");
-        if (text) description=Add2Description(description,text->Value(),xEvent->OrigTitle());
+        cTEXTMapping *text=g->TEXTMappings()->GetMap("year");
+        if (text) description=Add2Description(description,text->Value(),xEvent->Year());
     }
-    if ((what==USE_CATEGORIES) && ((Flags & USE_CATEGORIES)==USE_CATEGORIES) &&
-            (xEvent->Category()->Size()))
+    return description;
+}
+
+char *cImport::AddOrigTitle2Description(char *description, cXMLTVEvent *xEvent, int UNUSED(Flags))
+{
+    if (!xEvent->OrigTitle()) return description;
+    cTEXTMapping *text=g->TEXTMappings()->GetMap("originaltitle");
+    if (text) description=Add2Description(description,text->Value(),xEvent->OrigTitle());
+    return description;
+}
+
+char *cImport::AddCategories2Description(char *description, cXMLTVEvent *xEvent, int UNUSED(Flags))
+{
+    if (!xEvent->Category()->Size()) return description;
+    cTEXTMapping *text=g->TEXTMappings()->GetMap("category");
+    if (text)
     {
-        cTEXTMapping *text=g->TEXTMappings()->GetMap("category");
-        if (text)
+        cXMLTVStringList *categories=xEvent->Category();
+        // prevent duplicates
+        if ((*categories)[0][0]!='G' && (*categories)[0][1]!=' ')
+            description=Add2Description(description,text->Value(),(*categories)[0]);
+        for (int i=1; i<categories->Size(); i++)
         {
-            cXMLTVStringList *categories=xEvent->Category();
-            // prevent duplicates
-            if ((*categories)[0][0]!='G' && (*categories)[0][1]!=' ')
-                description=Add2Description(description,text->Value(),(*categories)[0]);
-            for (int i=1; i<categories->Size(); i++)
+            if (strcasecmp((*categories)[i],(*categories)[i-1]))
             {
-                if (strcasecmp((*categories)[i],(*categories)[i-1]))
-                {
-                    if ((*categories)[i][0]!='G' && (*categories)[i][1]!=' ')
-                        description=Add2Description(description,text->Value(),(*categories)[i]);
-                }
+                if ((*categories)[i][0]!='G' && (*categories)[i][1]!=' ')
+                    description=Add2Description(description,text->Value(),(*categories)[i]);
             }
         }
     }
+    return description;
+}
 
-    if ((what==USE_VIDEO) && ((Flags & USE_VIDEO)==USE_VIDEO) && (xEvent->Video()->Size()))
+char *cImport::AddVideo2Description(char *description, cXMLTVEvent *xEvent, int UNUSED(Flags))
+{
+    if (!xEvent->Video()->Size()) return description;
+    cTEXTMapping *text=g->TEXTMappings()->GetMap("video");
+    if (text)
     {
-        cTEXTMapping *text=g->TEXTMappings()->GetMap("video");
-        if (text)
+        description=Add2Description(description,text->Value());
+        description=Add2Description(description,": ");
+        cXMLTVStringList *video=xEvent->Video();
+        for (int i=0; i<video->Size(); i++)
         {
-            description=Add2Description(description,text->Value());
-            description=Add2Description(description,": ");
-            cXMLTVStringList *video=xEvent->Video();
-            for (int i=0; i<video->Size(); i++)
+            char *vtype=strdup((*video)[i]);
+            if (vtype)
             {
-                char *vtype=strdup((*video)[i]);
-                if (vtype)
+                char *vval=strchr(vtype,'|');
+                if (vval)
                 {
-                    char *vval=strchr(vtype,'|');
-                    if (vval)
-                    {
-                        *vval=0;
-                        vval++;
+                    *vval=0;
+                    vval++;
 
-                        if (i)
-                        {
-                            description=Add2Description(description,", ");
-                        }
+                    if (i)
+                    {
+                        description=Add2Description(description,", ");
+                    }
 
-                        if (!strcasecmp(vtype,"colour"))
-                        {
-                            if (!strcasecmp(vval,"no"))
-                            {
-                                cTEXTMapping *text=g->TEXTMappings()->GetMap("blacknwhite");
-                                description=Add2Description(description,text->Value());
-                            }
-                        }
-                        else
+                    if (!strcasecmp(vtype,"colour"))
+                    {
+                        if (!strcasecmp(vval,"no"))
                         {
-                            description=Add2Description(description,vval);
+                            cTEXTMapping *text=g->TEXTMappings()->GetMap("blacknwhite");
+                            description=Add2Description(description,text->Value());
                         }
                     }
-                    free(vtype);
+                    else
+                    {
+                        description=Add2Description(description,vval);
+                    }
                 }
+                free(vtype);
             }
-            description=Add2Description(description,"\n");
         }
+        description=Add2Description(description,"\n");
     }
+    return description;
+}
 
-    if ((what==USE_AUDIO) && ((Flags & USE_AUDIO)==USE_AUDIO))
+char *cImport::AddAudio2Description(char *description, cXMLTVEvent *xEvent, int UNUSED(Flags))
+{
+    if (xEvent->Audio())
     {
-        if (xEvent->Audio())
+        cTEXTMapping *text=g->TEXTMappings()->GetMap("audio");
+        if (text)
         {
-            cTEXTMapping *text=g->TEXTMappings()->GetMap("audio");
-            if (text)
-            {
 
-                if ((!strcasecmp(xEvent->Audio(),"mono")) || (!strcasecmp(xEvent->Audio(),"stereo")))
+            if ((!strcasecmp(xEvent->Audio(),"mono")) || (!strcasecmp(xEvent->Audio(),"stereo")))
+            {
+                description=Add2Description(description,text->Value());
+                description=Add2Description(description,": ");
+                description=Add2Description(description,xEvent->Audio());
+                description=Add2Description(description,"\n");
+            }
+            else
+            {
+                cTEXTMapping *atext=g->TEXTMappings()->GetMap(xEvent->Audio());
+                if (atext)
                 {
                     description=Add2Description(description,text->Value());
                     description=Add2Description(description,": ");
-                    description=Add2Description(description,xEvent->Audio());
+                    description=Add2Description(description,atext->Value());
                     description=Add2Description(description,"\n");
                 }
-                else
-                {
-                    cTEXTMapping *atext=g->TEXTMappings()->GetMap(xEvent->Audio());
-                    if (atext)
-                    {
-                        description=Add2Description(description,text->Value());
-                        description=Add2Description(description,": ");
-                        description=Add2Description(description,atext->Value());
-                        description=Add2Description(description,"\n");
-                    }
-                }
             }
         }
     }
-    if ((what==USE_SEASON) && ((Flags & USE_SEASON)==USE_SEASON))
+    return description;
+}
+
+char *cImport::AddSeason2Description(char *description, cXMLTVEvent *xEvent, int UNUSED(Flags))
+{
+    if (xEvent->Season())
     {
-        if (xEvent->Season())
-        {
-            cTEXTMapping *text=g->TEXTMappings()->GetMap("season");
-            if (text) description=Add2Description(description,text->Value(),
-                                                      xEvent->Season());
-        }
+        cTEXTMapping *text=g->TEXTMappings()->GetMap("season");
+        if (text) description=Add2Description(description,text->Value(),
+                                                  xEvent->Season());
+    }
 
-        if (xEvent->Episode())
-        {
-            cTEXTMapping *text=g->TEXTMappings()->GetMap("episode");
-            if (text) description=Add2Description(description,text->Value(),
-                                                      xEvent->Episode());
-        }
+    if (xEvent->Episode())
+    {
+        cTEXTMapping *text=g->TEXTMappings()->GetMap("episode");
+        if (text) description=Add2Description(description,text->Value(),
+                                                  xEvent->Episode());
+    }
 
-        if (xEvent->EpisodeOverall())
-        {
-            cTEXTMapping *text=g->TEXTMappings()->GetMap("episodeoverall");
-            if (text) description=Add2Description(description,text->Value(),
-                                                      xEvent->EpisodeOverall());
-        }
+    if (xEvent->EpisodeOverall())
+    {
+        cTEXTMapping *text=g->TEXTMappings()->GetMap("episodeoverall");
+        if (text) description=Add2Description(description,text->Value(),
+                                                  xEvent->EpisodeOverall());
     }
+    return description;
+}
 
-    if ((what==USE_RATING) && ((Flags & USE_RATING)==USE_RATING) &&
-            (xEvent->Rating()->Size()))
+char *cImport::AddRating2Description(char *description, cXMLTVEvent *xEvent, int UNUSED(Flags))
+{
+    cXMLTVStringList *rating=xEvent->Rating();
+    for (int i=0; i<rating->Size(); i++)
     {
-#if VDRVERSNUM < 10711 && !EPGHANDLER
-        Flags|=OPT_RATING_TEXT; // always add to text if we dont have the internal tag!
-#endif
-        if ((Flags & OPT_RATING_TEXT)==OPT_RATING_TEXT)
+        char *rtype=strdup((*rating)[i]);
+        if (rtype)
         {
-            cXMLTVStringList *rating=xEvent->Rating();
-            for (int i=0; i<rating->Size(); i++)
+            char *rval=strchr(rtype,'|');
+            if (rval)
             {
-                char *rtype=strdup((*rating)[i]);
-                if (rtype)
-                {
-                    char *rval=strchr(rtype,'|');
-                    if (rval)
-                    {
-                        *rval=0;
-                        rval++;
+                *rval=0;
+                rval++;
 
-                        description=Add2Description(description,rtype);
-                        description=Add2Description(description,": ");
-                        description=Add2Description(description,rval);
-                        description=Add2Description(description,"\n");
-                    }
-                    free(rtype);
-                }
+                description=Add2Description(description,rtype);
+                description=Add2Description(description,": ");
+                description=Add2Description(description,rval);
+                description=Add2Description(description,"\n");
             }
+            free(rtype);
         }
     }
+    return description;
+}
 
-    if ((what==USE_STARRATING) && ((Flags & USE_STARRATING)==USE_STARRATING) &&
-            (xEvent->StarRating()->Size()))
+char *cImport::AddStarRating2Description(char *description, cXMLTVEvent *xEvent, int UNUSED(Flags))
+{
+    if (!xEvent->StarRating()->Size()) return description;
+    cTEXTMapping *text=g->TEXTMappings()->GetMap("starrating");
+    if (text)
     {
-        cTEXTMapping *text=g->TEXTMappings()->GetMap("starrating");
-        if (text)
+        description=Add2Description(description,text->Value());
+        description=Add2Description(description,": ");
+        cXMLTVStringList *starrating=xEvent->StarRating();
+        for (int i=0; i<starrating->Size(); i++)
         {
-            description=Add2Description(description,text->Value());
-            description=Add2Description(description,": ");
-            cXMLTVStringList *starrating=xEvent->StarRating();
-            for (int i=0; i<starrating->Size(); i++)
+            char *rtype=strdup((*starrating)[i]);
+            if (rtype)
             {
-                char *rtype=strdup((*starrating)[i]);
-                if (rtype)
+                char *rval=strchr(rtype,'|');
+                if (rval)
                 {
-                    char *rval=strchr(rtype,'|');
-                    if (rval)
-                    {
-                        *rval=0;
-                        rval++;
+                    *rval=0;
+                    rval++;
 
-                        if (i)
-                        {
-                            description=Add2Description(description,", ");
-                        }
-                        if (strcasecmp(rtype,"*"))
-                        {
-                            description=Add2Description(description,rtype);
-                            description=Add2Description(description," ");
-                        }
-                        description=Add2Description(description,rval);
+                    if (i)
+                    {
+                        description=Add2Description(description,", ");
                     }
-                    free(rtype);
+                    if (strcasecmp(rtype,"*"))
+                    {
+                        description=Add2Description(description,rtype);
+                        description=Add2Description(description," ");
+                    }
+                    description=Add2Description(description,rval);
                 }
+                free(rtype);
             }
-            description=Add2Description(description,"\n");
         }
+        description=Add2Description(description,"\n");
     }
+    return description;
+}
 
-    if ((what==USE_REVIEW) && ((Flags & USE_REVIEW)==USE_REVIEW) &&
-            (xEvent->Review()->Size()))
+char *cImport::AddReview2Description(char *description, cXMLTVEvent *xEvent, int UNUSED(Flags))
+{
+    if (!xEvent->Review()->Size()) return description;
+    cTEXTMapping *text=g->TEXTMappings()->GetMap("review");
+    if (text)
     {
-        cTEXTMapping *text=g->TEXTMappings()->GetMap("review");
-        if (text)
+        cXMLTVStringList *review=xEvent->Review();
+        for (int i=0; i<review->Size(); i++)
         {
-            cXMLTVStringList *review=xEvent->Review();
-            for (int i=0; i<review->Size(); i++)
-            {
-                description=Add2Description(description,text->Value(),(*review)[i]);
-            }
+            description=Add2Description(description,text->Value(),(*review)[i]);
         }
     }
-
     return description;
 }
 
+const cImport::descplan *cImport::GetDescPlan(int Flags)
+{
+    if (plansetup!=g->SetupGeneration())
+    {
+        // setup has been changed, forget all compiled plans
+        plans.clear();
+        plansetup=g->SetupGeneration();
+    }
+
+    std::map<int,descplan>::iterator it=plans.find(Flags);
+    if (it!=plans.end()) return &it->second;
+
+    int ratingflags=USE_RATING|OPT_RATING_TEXT;
+#if VDRVERSNUM < 10711 && !EPGHANDLER
+    ratingflags=USE_RATING; // always add to text if we dont have the internal tag!
+#endif
+    static const struct
+    {
+        const char *name;
+        int flags;
+        addsection add;
+    } sections[]=
+    {
+        { "LOT", 0, &cImport::AddLongText2Description },
+        { "CRS", USE_CREDITS, &cImport::AddCredits2Description },
+        { "CAD", USE_COUNTRYDATE, &cImport::AddCountryDate2Description },
+        { "ORT", USE_ORIGTITLE, &cImport::AddOrigTitle2Description },
+        { "CAT", USE_CATEGORIES, &cImport::AddCategories2Description },
+        { "VID", USE_VIDEO, &cImport::AddVideo2Description },
+        { "AUD", USE_AUDIO, &cImport::AddAudio2Description },
+        { "SEE", USE_SEASON, &cImport::AddSeason2Description },
+        { "RAT", -1, &cImport::AddRating2Description },
+        { "STR", USE_STARRATING, &cImport::AddStarRating2Description },
+        { "REV", USE_REVIEW, &cImport::AddReview2Description }
+    };
+
+    descplan plan;
+    plan.count=0;
+
+    const char *ot=g->Order();
+    while (ot && *ot && plan.count<MAXSECTIONS)
+    {
+        if (*ot==',') ot++;
+        for (size_t i=0; i<sizeof(sections)/sizeof(sections[0]); i++)
+        {
+            if (strncmp(ot,sections[i].name,3)) continue;
+            int need=(sections[i].flags==-1) ? ratingflags : sections[i].flags;
+            if ((Flags & need)==need) plan.add[plan.count++]=sections[i].add;
+            break;
+        }
+        if (strlen(ot)<3) break;
+        ot+=3;
+    }
+    tsyslog("compiled description plan for flags %i with %i sections",Flags,plan.count);
+    return &(plans[Flags]=plan);
+}
+
+time_t cImport::EPListsModified()
+{
+    // newest episode file, the lists are only read while parsing and by the EIT handler
+    if (!g->EPDir()) return 0;
+    DIR *dir=opendir(g->EPDir());
+    if (!dir) return 0;
+    time_t modified=0;
+    struct dirent *dirent;
+    while ((dirent=readdir(dir)))
+    {
+        if (dirent->d_name[0]=='.') continue;
+        char *file;
+        if (asprintf(&file,"%s/%s",g->EPDir(),dirent->d_name)==-1) continue;
+        struct stat statbuf;
+        if ((stat(file,&statbuf)==0) && (statbuf.st_mtime>modified)) modified=statbuf.st_mtime;
+        free(file);
+    }
+    closedir(dir);
+    return modified;
+}
+
+uint64_t cImport::SetupHash()
+{
+    // everything in the setup which changes the imported events, kept across restarts
+    uint64_t hash=HashStr(g->Order());
+    hash=g->EPGMappings()->Hash(hash);
+    hash=g->TEXTMappings()->Hash(hash);
+    return HashInt(EPListsModified(),hash);
+}
+
+uint64_t cImport::StateHash(const cEvent *Event)
+{
+    uint64_t hash=HashStr(Event->Title());
+    hash=HashStr(Event->ShortText(),hash);
+    hash=HashStr(Event->Description(),hash);
+    hash=HashInt(Event->StartTime(),hash);
+    hash=HashInt(Event->Duration(),hash);
+    return hash;
+}
+
 bool cImport::PutEvent(cEPGSource *Source, sqlite3 *Db, cSchedule* Schedule,
-                       cEvent *Event, cXMLTVEvent *xEvent,int Flags)
+                       cEvent *Event, cXMLTVEvent *xEvent,int Flags, bool *Applied)
 {
     if (!Source) return false;
-    if (!Db) return false;
+    if (!Db && !writer) return false;
     if (!xEvent) return false;
     if (!g) return false;
+    if (!LoadXMLTVEvent(Db,xEvent)) return false;
 
 #define CHANGED_NOTHING     0
 #define CHANGED_TITLE       1
 #define CHANGED_SHORTTEXT   2
 #define CHANGED_DESCRIPTION 4
+#define CHANGED_RATING      8
+#define CHANGED_CONTENTS    16
 
     struct tm tm;
     char from[80];
@@ -777,10 +912,20 @@ bool cImport::PutEvent(cEPGSource *Source, sqlite3 *Db, cSchedule* Schedule,
         end=start+xEvent->Duration();
 
         /* checking the "space" for our new event */
-        cEvent *prev=GetEventBefore(Schedule,start);
-        if (prev)
+        scheduleindex.Build(Schedule);
+        cEvent *next=NULL;
+        cEvent *prev=scheduleindex.Predecessor(start,&next);
+        if (prev && xEvent->Duration() && scheduleindex.IsFree(start,end))
+        {
+            // nothing to adjust, just check for gaps
+            if (!next && (prev->EndTime()!=start))
+            {
+                tsyslogs(Source,"detected gap of %lis",(long int)(start-prev->EndTime()));
+            }
+        }
+        else if (prev)
         {
-            if (cEvent *next=(cEvent *) prev->Next())
+            if (next)
             {
                 if (prev->EndTime()==next->StartTime())
                 {
@@ -887,8 +1032,7 @@ bool cImport::PutEvent(cEPGSource *Source, sqlite3 *Db, cSchedule* Schedule,
         Event->SetTitle(xEvent->Title());
         Event->SetVersion(0);
         Event->SetTableID(0);
-        Schedule->AddEvent(Event);
-        Schedule->Sort();
+        scheduleindex.Add(Event);
         added=true;
         if (xEvent->Pics()->Size() && Source->UsePics())
         {
@@ -990,24 +1134,10 @@ bool cImport::PutEvent(cEPGSource *Source, sqlite3 *Db, cSchedule* Schedule,
 
     char *description=NULL;
 
-    const char *ot=g->Order();
-    if (!ot) return false;
-
-    while (*ot)
+    const descplan *plan=GetDescPlan(Flags);
+    for (int i=0; i<plan->count; i++)
     {
-        if (*ot==',') ot++;
-        if (!strncmp(ot,"LOT",3)) description=Add2Description(description,xEvent,Flags,USE_LONGTEXT);
-        if (!strncmp(ot,"CRS",3)) description=Add2Description(description,xEvent,Flags,USE_CREDITS);
-        if (!strncmp(ot,"CAD",3)) description=Add2Description(description,xEvent,Flags,USE_COUNTRYDATE);
-        if (!strncmp(ot,"ORT",3)) description=Add2Description(description,xEvent,Flags,USE_ORIGTITLE);
-        if (!strncmp(ot,"CAT",3)) description=Add2Description(description,xEvent,Flags,USE_CATEGORIES);
-        if (!strncmp(ot,"VID",3)) description=Add2Description(description,xEvent,Flags,USE_VIDEO);
-        if (!strncmp(ot,"AUD",3)) description=Add2Description(description,xEvent,Flags,USE_AUDIO);
-        if (!strncmp(ot,"SEE",3)) description=Add2Description(description,xEvent,Flags,USE_SEASON);
-        if (!strncmp(ot,"RAT",3)) description=Add2Description(description,xEvent,Flags,USE_RATING);
-        if (!strncmp(ot,"STR",3)) description=Add2Description(description,xEvent,Flags,USE_STARRATING);
-        if (!strncmp(ot,"REV",3)) description=Add2Description(description,xEvent,Flags,USE_REVIEW);
-        ot+=3;
+        description=(this->*plan->add[i])(description,xEvent,Flags);
     }
 
     if (description)
@@ -1029,6 +1159,7 @@ bool cImport::PutEvent(cEPGSource *Source, sqlite3 *Db, cSchedule* Schedule,
         if (xEvent->ParentalRating() && xEvent->ParentalRating()>Event->ParentalRating())
         {
             Event->SetParentalRating(xEvent->ParentalRating());
+            changed|=CHANGED_RATING;
         }
     }
 #endif
@@ -1084,7 +1215,16 @@ bool cImport::PutEvent(cEPGSource *Source, sqlite3 *Db, cSchedule* Schedule,
                     }
                 }
                 free(val);
-                Event->SetContents(contents);
+                bool differs=false;
+                for (int i=0; i<MaxEventContents; i++)
+                {
+                    if (contents[i]!=Event->Contents(i)) differs=true;
+                }
+                if (differs)
+                {
+                    Event->SetContents(contents);
+                    changed|=CHANGED_CONTENTS;
+                }
             }
         }
     }
@@ -1122,6 +1262,8 @@ bool cImport::PutEvent(cEPGSource *Source, sqlite3 *Db, cSchedule* Schedule,
             if ((changed & CHANGED_TITLE)==CHANGED_TITLE) strcat(buf,"title,");
             if ((changed & CHANGED_SHORTTEXT)==CHANGED_SHORTTEXT) strcat(buf,"stext,");
             if ((changed & CHANGED_DESCRIPTION)==CHANGED_DESCRIPTION) strcat(buf,"descr,");
+            if ((changed & CHANGED_RATING)==CHANGED_RATING) strcat(buf,"rating,");
+            if ((changed & CHANGED_CONTENTS)==CHANGED_CONTENTS) strcat(buf,"contents,");
             int len=strlen(buf);
             if (len>0) buf[len-1]=0;
 
@@ -1131,144 +1273,255 @@ bool cImport::PutEvent(cEPGSource *Source, sqlite3 *Db, cSchedule* Schedule,
         }
         retcode=true;
     }
+    if (Applied) *Applied=true;
     return retcode;
 }
 
-bool cImport::FetchXMLTVEvent(sqlite3_stmt *stmt, cXMLTVEvent *xevent)
+// key and match columns, the large text columns are loaded by rowid when needed
+#define XMLTV_KEYS "channelid,eventid,starttime,duration,title,alttitle,src,eiteventid,rowid"
+#define XMLTV_KEYCOLS 9
+#define XMLTV_HEAVY "origtitle,shorttext,description,country,year,credits,category,review,rating," \
+                    "starrating,video,audio,season,episode,episodeoverall,pics,eitdescription"
+
+bool cImport::FetchXMLTVEvent(sqlite3_stmt *stmt, cXMLTVEvent *xevent, int First, int Count)
 {
     if (!stmt) return false;
     if (!xevent) return false;
-    xevent->Clear();
+    // First is the field of the 1st result column, see XMLTV_KEYS and XMLTV_HEAVY
+    if (!First) xevent->Clear();
     int cols=sqlite3_column_count(stmt);
-    for (int col=0; col<cols; col++)
+    if ((Count>=0) && (Count<cols)) cols=Count;
+    for (int col=First; col<First+cols; col++)
     {
         switch (col)
         {
         case 0:
-            xevent->SetChannelID((const char *) sqlite3_column_text(stmt,col));
+            xevent->SetChannelID((const char *) sqlite3_column_text(stmt,col-First));
             break;
         case 1:
-            xevent->SetEventID(sqlite3_column_int(stmt,col));
+            xevent->SetEventID(sqlite3_column_int(stmt,col-First));
             break;
         case 2:
-            xevent->SetStartTime(sqlite3_column_int(stmt,col));
+            xevent->SetStartTime(sqlite3_column_int(stmt,col-First));
             break;
         case 3:
-            xevent->SetDuration(sqlite3_column_int(stmt,col));
+            xevent->SetDuration(sqlite3_column_int(stmt,col-First));
             break;
         case 4:
-            xevent->SetTitle((const char *) sqlite3_column_text(stmt,col));
+            xevent->SetTitle((const char *) sqlite3_column_text(stmt,col-First));
             break;
         case 5:
-            xevent->SetOrigTitle((const char *) sqlite3_column_text(stmt,col));
+            xevent->SetAltTitle((const char *) sqlite3_column_text(stmt,col-First));
             break;
         case 6:
-            xevent->SetShortText((const char *) sqlite3_column_text(stmt,col));
+            xevent->SetSource((const char *) sqlite3_column_text(stmt,col-First));
             break;
         case 7:
-            xevent->SetDescription((const char *) sqlite3_column_text(stmt,col));
+            xevent->SetEITEventID(sqlite3_column_int(stmt,col-First));
             break;
         case 8:
-            xevent->SetCountry((const char *) sqlite3_column_text(stmt,col));
+            xevent->SetRowID(sqlite3_column_int64(stmt,col-First));
             break;
         case 9:
-            xevent->SetYear(sqlite3_column_int(stmt,col));
+            xevent->SetOrigTitle((const char *) sqlite3_column_text(stmt,col-First));
             break;
         case 10:
-            xevent->SetCredits((const char *) sqlite3_column_text(stmt,col));
+            xevent->SetShortText((const char *) sqlite3_column_text(stmt,col-First));
             break;
         case 11:
-            xevent->SetCategory((const char *) sqlite3_column_text(stmt,col));
+        {
+            char *text=cXMLTVCompressor::ColumnText(stmt,col-First);
+            xevent->SetDescription(text);
+            free(text);
             break;
+        }
         case 12:
-            xevent->SetReview((const char *) sqlite3_column_text(stmt,col));
+            xevent->SetCountry((const char *) sqlite3_column_text(stmt,col-First));
             break;
         case 13:
-            xevent->SetRating((const char *) sqlite3_column_text(stmt,col));
+            xevent->SetYear(sqlite3_column_int(stmt,col-First));
             break;
         case 14:
-            xevent->SetStarRating((const char *) sqlite3_column_text(stmt,col));
+        {
+            char *text=cXMLTVCompressor::ColumnText(stmt,col-First);
+            xevent->SetCredits(text);
+            free(text);
             break;
+        }
         case 15:
-            xevent->SetVideo((const char *) sqlite3_column_text(stmt,col));
+            xevent->SetCategory((const char *) sqlite3_column_text(stmt,col-First));
             break;
         case 16:
-            xevent->SetAudio((const char *) sqlite3_column_text(stmt,col));
+        {
+            char *text=cXMLTVCompressor::ColumnText(stmt,col-First);
+            xevent->SetReview(text);
+            free(text);
             break;
+        }
         case 17:
-            xevent->SetSeason(sqlite3_column_int(stmt,col));
+            xevent->SetRating((const char *) sqlite3_column_text(stmt,col-First));
             break;
         case 18:
-            xevent->SetEpisode(sqlite3_column_int(stmt,col));
+            xevent->SetStarRating((const char *) sqlite3_column_text(stmt,col-First));
             break;
         case 19:
-            xevent->SetEpisodeOverall(sqlite3_column_int(stmt,col));
+            xevent->SetVideo((const char *) sqlite3_column_text(stmt,col-First));
             break;
         case 20:
-            xevent->SetPics((const char *) sqlite3_column_text(stmt,col));
+            xevent->SetAudio((const char *) sqlite3_column_text(stmt,col-First));
             break;
         case 21:
-            xevent->SetSource((const char *) sqlite3_column_text(stmt,col));
+            xevent->SetSeason(sqlite3_column_int(stmt,col-First));
             break;
         case 22:
-            xevent->SetEITEventID(sqlite3_column_int(stmt,col));
+            xevent->SetEpisode(sqlite3_column_int(stmt,col-First));
             break;
         case 23:
-            xevent->SetEITDescription((const char *) sqlite3_column_text(stmt,col));
+            xevent->SetEpisodeOverall(sqlite3_column_int(stmt,col-First));
             break;
         case 24:
-            xevent->SetAltTitle((const char *) sqlite3_column_text(stmt,col));
+            xevent->SetPics((const char *) sqlite3_column_text(stmt,col-First));
+            break;
+        case 25:
+        {
+            char *text=cXMLTVCompressor::ColumnText(stmt,col-First);
+            xevent->SetEITDescription(text);
+            free(text);
             break;
         }
+        }
     }
+    if (!First) xevent->SetPartial(cols<=XMLTV_KEYCOLS);
+    if (First+cols>XMLTV_KEYCOLS) xevent->SetPartial(false);
     return true;
 }
 
-cXMLTVEvent *cImport::PrepareAndReturn(sqlite3 **db, char *sql)
+// ?1 starttime, ?2/?3 search window, ?4 key, ?5 channelid
+#define XMLTV_SEARCH(key) "select " XMLTV_KEYS " from epg where (starttime>=?2 and starttime<=?3) and " \
+                          key "=?4 and channelid=?5 order by abs(starttime-?1),srcidx asc limit 1;"
+
+// timer events of one batch, without rowid so that "rowid" still means epg.rowid
+#define TIMER_TABLE "CREATE TEMP TABLE IF NOT EXISTS timerevents (tidx INTEGER PRIMARY KEY, tchannelid TEXT, " \
+                    "teventid INT, tstart INT, tmin INT, tmax INT, ttitle TEXT, tsoundex TEXT) WITHOUT ROWID; " \
+                    "DELETE FROM timerevents;"
+
+// columns 9-12 are only used for sorting
+#define TIMER_MATCH(prio,cond) "select " XMLTV_KEYS ",tidx," prio " as tprio,abs(starttime-tstart) as tdiff," \
+                               "srcidx from timerevents join epg on channelid=tchannelid and " \
+                               "starttime>=tmin and starttime<=tmax and " cond
+
+static const char *const stmtsql[]=
+{
+    "select " XMLTV_KEYS " from epg where rowid=?1;",
+    XMLTV_SEARCH("eiteventid"),
+    XMLTV_SEARCH("soundex_title"),
+    XMLTV_SEARCH("title"),
+    cXMLTVEvent::InsertSQL,
+    cXMLTVEvent::UpdateSQL,
+    "update epg set season=?1, episode=?2, episodeoverall=?3, shorttext=coalesce(?4,shorttext) " \
+    "where eventid=?5 and src=?6 and channelid=?7;",
+    "update epg set eiteventid=?1, eitdescription=coalesce(?2,eitdescription) " \
+    "where eventid=?3 and src=?4 and channelid=?5;",
+    "insert into timerevents values (?1,?2,?3,?4,?5,?6,?7,?8);",
+    TIMER_MATCH("0","eiteventid=teventid") " union all " \
+    TIMER_MATCH("1","soundex_title=tsoundex") " union all " \
+    TIMER_MATCH("1","title=ttitle and tsoundex is null") \
+    " order by tidx,tprio,tdiff,srcidx;",
+    "select " XMLTV_HEAVY " from epg where rowid=?1;"
+};
+
+sqlite3_stmt *cImport::Statement(sqlite3 *Db, int Which)
 {
-    if (!db) return NULL;
-    if (!*db) return NULL;
-    if (!sql) return NULL;
+    if (!Db) return NULL;
+    if ((Which<0) || (Which>=MAXSTMTS)) return NULL;
 
-    sqlite3_stmt *stmt=NULL;
-    int ret=sqlite3_prepare_v2(*db,sql,strlen(sql),&stmt,NULL);
+    // statements are kept for the lifetime of the connection
+    if (Db!=stmtdb)
+    {
+        FinalizeStatements();
+        stmtdb=Db;
+    }
+    if (stmts[Which])
+    {
+        sqlite3_reset(stmts[Which]);
+        sqlite3_clear_bindings(stmts[Which]);
+        return stmts[Which];
+    }
+
+    int ret=sqlite3_prepare_v2(Db,stmtsql[Which],-1,&stmts[Which],NULL);
     if (ret!=SQLITE_OK)
     {
-        const char *errmsg=sqlite3_errmsg(*db);
-        if (errmsg)
+        if ((ret==SQLITE_BUSY) || (ret==SQLITE_LOCKED))
         {
-            if (strstr(errmsg,"no such column"))
-            {
-                esyslog("sqlite3: database schema changed, unlinking epg.db!");
-                sqlite3_close(*db);
-                *db=NULL;
-                unlink(g->EPGFile());
-            }
-            else
-            {
-                if ((ret==SQLITE_BUSY) || (ret==SQLITE_LOCKED))
-                {
-                    tsyslog("sqlite3: %i %s (par)",ret,errmsg);
-                }
-                else
-                {
-                    esyslog("sqlite3: %i %s (par)",ret,errmsg);
-                    tsyslog("sqlite3: %s",sql);
-                }
-            }
+            tsyslog("sqlite3: %i %s (par)",ret,sqlite3_errmsg(Db));
         }
-        free(sql);
-        return NULL;
+        else
+        {
+            esyslog("sqlite3: %i %s (par)",ret,sqlite3_errmsg(Db));
+            tsyslog("sqlite3: %s",stmtsql[Which]);
+        }
+        stmts[Which]=NULL;
+    }
+    return stmts[Which];
+}
+
+void cImport::FinalizeStatements()
+{
+    for (int i=0; i<MAXSTMTS; i++)
+    {
+        if (stmts[i]) sqlite3_finalize(stmts[i]);
+        stmts[i]=NULL;
+    }
+    stmtdb=NULL;
+}
+
+void cImport::Close(sqlite3 *Db)
+{
+    if (!Db) return;
+    if (Db==stmtdb) FinalizeStatements();
+    cEPGDatabase::Close(Db);
+}
+
+sqlite3_stmt *cImport::SearchStatement(sqlite3 **Db, int Which)
+{
+    sqlite3_stmt *stmt=Statement(*Db,Which);
+    if (stmt) return stmt;
+
+    // epg.db was replaced by an older file, reopen once the parser migrated it
+    const char *errmsg=sqlite3_errmsg(*Db);
+    if (errmsg && strstr(errmsg,"no such column"))
+    {
+        esyslog("sqlite3: outdated database schema, reopening epg.db");
+        Close(*Db);
+        *Db=NULL;
     }
+    return NULL;
+}
 
+bool cImport::LoadXMLTVEvent(sqlite3 *Db, cXMLTVEvent *xEvent)
+{
+    if (!xEvent) return false;
+    if (!xEvent->Partial()) return true;
+    if (!xEvent->RowID()) return false;
+    sqlite3_stmt *stmt=Statement(Db,STMT_HEAVY);
+    if (!stmt) return false;
+    sqlite3_bind_int64(stmt,1,xEvent->RowID());
+    bool ret=false;
+    if (sqlite3_step(stmt)==SQLITE_ROW) ret=FetchXMLTVEvent(stmt,xEvent,XMLTV_KEYCOLS);
+    sqlite3_reset(stmt);
+    return ret;
+}
+
+cXMLTVEvent *cImport::StepAndReturn(sqlite3_stmt *stmt)
+{
+    if (!stmt) return NULL;
     cXMLTVEvent *xevent=NULL;
     if (sqlite3_step(stmt)==SQLITE_ROW)
     {
         xevent = new cXMLTVEvent();
         FetchXMLTVEvent(stmt,xevent);
     }
-    sqlite3_finalize(stmt);
-    free(sql);
+    sqlite3_reset(stmt);
     return xevent;
 }
 
@@ -1296,7 +1549,7 @@ bool cImport::AddShortTextFromEITDescription(cXMLTVEvent *xEvent, const char *EI
 cXMLTVEvent *cImport::AddXMLTVEvent(cEPGSource *Source,sqlite3 *Db, const char *ChannelID, const cEvent *Event,
                                     const char *EITDescription, bool UseEPText)
 {
-    if (!Db) return NULL;
+    if (!Db && !writer) return NULL;
     if (!Source) return NULL;
     if (!ChannelID) return NULL;
     if (!Event) return NULL;
@@ -1325,24 +1578,37 @@ cXMLTVEvent *cImport::AddXMLTVEvent(cEPGSource *Source,sqlite3 *Db, const char *
         }
     }
 
-    cXMLTVEvent *xevent = new cXMLTVEvent();
-    if (!xevent)
+    const char *alttitle=NULL,*shorttext=Event->ShortText();
+    if (UseEPText)
     {
-        esyslogs(Source,"out of memory");
-        if (epshorttext) free(epshorttext);
-        if (eptitle) free(eptitle);
-        return NULL;
+        alttitle=eptitle;
+        shorttext=epshorttext;
     }
-
-    if (UseEPText)
+    cXMLTVEvent *xevent=NewXMLTVEvent(Event,EITDescription,alttitle,shorttext,season,episode,episodeoverall);
+    if (writer)
     {
-        if (eptitle) xevent->SetAltTitle(eptitle);
-        if (epshorttext) xevent->SetShortText(epshorttext);
+        // the writer thread gets its own copy
+        writer->Insert(Source->Name(),ChannelID,NewXMLTVEvent(Event,EITDescription,alttitle,shorttext,
+                       season,episode,episodeoverall));
     }
-    else
+    if (epshorttext) free(epshorttext);
+    if (eptitle) free(eptitle);
+    if (writer) return xevent;
+
+    if (!InsertXMLTVEvent(Source,Db,ChannelID,xevent))
     {
-        xevent->SetShortText(Event->ShortText());
+        delete xevent;
+        return NULL;
     }
+    return xevent;
+}
+
+cXMLTVEvent *cImport::NewXMLTVEvent(const cEvent *Event, const char *EITDescription, const char *AltTitle,
+                                    const char *ShortText, int Season, int Episode, int EpisodeOverall)
+{
+    cXMLTVEvent *xevent = new cXMLTVEvent();
+    if (AltTitle) xevent->SetAltTitle(AltTitle);
+    if (ShortText) xevent->SetShortText(ShortText);
     xevent->SetTitle(Event->Title());
     xevent->SetStartTime(Event->StartTime());
     xevent->SetDuration(Event->Duration());
@@ -1353,48 +1619,49 @@ cXMLTVEvent *cImport::AddXMLTVEvent(cEPGSource *Source,sqlite3 *Db, const char *
         xevent->SetDescription(EITDescription);
         xevent->SetEITDescription(EITDescription);
     }
-    xevent->SetSeason(season);
-    xevent->SetEpisode(episode);
-    xevent->SetEpisodeOverall(episodeoverall);
-    if (epshorttext) free(epshorttext);
-    if (eptitle) free(eptitle);
+    xevent->SetSeason(Season);
+    xevent->SetEpisode(Episode);
+    xevent->SetEpisodeOverall(EpisodeOverall);
+    return xevent;
+}
+
+bool cImport::InsertXMLTVEvent(cEPGSource *Source, sqlite3 *Db, const char *ChannelID, cXMLTVEvent *xEvent)
+{
+    if (!Begin(Source,Db)) return false;
 
-    if (!Begin(Source,Db))
+    sqlite3_stmt *stmt=Statement(Db,STMT_INSERT);
+    if (!xEvent->Bind(stmt,Source->Name(),99,ChannelID)) return false;
+    int ret=sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    if (ret==SQLITE_DONE)
     {
-        delete xevent;
-        return NULL;
+        xEvent->SetRowID(sqlite3_last_insert_rowid(Db));
+        g->XMLTVCache()->Add(ChannelID,xEvent->StartTime(),xEvent->EITEventID(),99,
+                             xEvent->Title(),xEvent->RowID());
     }
-
-    char *isql,*usql;
-    xevent->GetSQL(Source->Name(),99,ChannelID,&isql,&usql);
-    if (isql && usql)
+    else
     {
-        char *errmsg;
-        int ret=sqlite3_exec(Db,isql,NULL,NULL,&errmsg);
-        if (ret!=SQLITE_OK)
+        if (ret==SQLITE_CONSTRAINT)
         {
-            if (ret==SQLITE_CONSTRAINT)
-            {
-                sqlite3_free(errmsg);
-                ret=sqlite3_exec(Db,usql,NULL,NULL,&errmsg);
-            }
-            if (ret!=SQLITE_OK)
+            stmt=Statement(Db,STMT_UPDATE);
+            if (xEvent->Bind(stmt,Source->Name(),99,ChannelID))
             {
-                esyslogs(Source,"sqlite3: %s",errmsg);
-                sqlite3_free(errmsg);
-                delete xevent;
-                return NULL;
+                ret=sqlite3_step(stmt);
+                sqlite3_reset(stmt);
             }
+            g->XMLTVCache()->Invalidate(ChannelID);
         }
-        /*
-        if (ret==SQLITE_OK)
+        if (ret!=SQLITE_DONE)
         {
-            tsyslogs(Source,"{%5i} adding '%s'/'%s' to db",xevent->EventID(),
-                     xevent->Title(),xevent->ShortText());
+            esyslogs(Source,"sqlite3: %s",sqlite3_errmsg(Db));
+            return false;
         }
-        */
     }
-    return xevent;
+    /*
+    tsyslogs(Source,"{%5i} adding '%s'/'%s' to db",xEvent->EventID(),
+             xEvent->Title(),xEvent->ShortText());
+    */
+    return true;
 }
 
 bool cImport::UpdateXMLTVEvent(cEPGSource *Source, sqlite3 *Db, cXMLTVEvent *xEvent)
@@ -1405,49 +1672,15 @@ bool cImport::UpdateXMLTVEvent(cEPGSource *Source, sqlite3 *Db, cXMLTVEvent *xEv
 
     if (!Begin(Source,Db)) return false;
 
-    char *sql=NULL;
-
-    if (xEvent->ShortText())
-    {
-        char *shortdesc=strdup(xEvent->ShortText());
-        if (!shortdesc)
-        {
-            esyslogs(Source,"out of memory");
-            return false;
-        }
-
-        std::string ed=shortdesc;
-
-        long unsigned int reps = ed.length();
-        ed = std::regex_replace(ed, std::regex("'"), "''");
-        if (reps != ed.length())
-        {
-            shortdesc=(char *) realloc(shortdesc,ed.size()+1);
-            strcpy(shortdesc,ed.c_str());
-        }
-
-        if (asprintf(&sql,"update epg set season=%li, episode=%li, episodeoverall=%li, shorttext='%s' "
-                     " where eventid=%li and src='%s' and channelid='%s'", (long int) xEvent->Season(),
-                     (long int) xEvent->Episode(), (long int) xEvent->EpisodeOverall()   ,shortdesc,
-                     (long int) xEvent->EventID(),Source->Name(),xEvent->ChannelID())==-1)
-        {
-            free(shortdesc);
-            esyslogs(Source,"out of memory");
-            return false;
-        }
-        free(shortdesc);
-    }
-    else
-    {
-        if (asprintf(&sql,"update epg set season=%li, episode=%li, episodeoverall=%li "
-                     " where eventid=%li and src='%s' and channelid='%s'", (long int) xEvent->Season(),
-                     (long int) xEvent->Episode(), (long int) xEvent->EpisodeOverall(),
-                     (long int) xEvent->EventID(),Source->Name(),xEvent->ChannelID())==-1)
-        {
-            esyslogs(Source,"out of memory");
-            return false;
-        }
-    }
+    sqlite3_stmt *stmt=Statement(Db,STMT_UPDATEEPISODE);
+    if (!stmt) return false;
+    sqlite3_bind_int(stmt,1,xEvent->Season());
+    sqlite3_bind_int(stmt,2,xEvent->Episode());
+    sqlite3_bind_int(stmt,3,xEvent->EpisodeOverall());
+    if (xEvent->ShortText()) sqlite3_bind_text(stmt,4,xEvent->ShortText(),-1,SQLITE_STATIC);
+    sqlite3_bind_int64(stmt,5,xEvent->EventID());
+    sqlite3_bind_text(stmt,6,Source->Name(),-1,SQLITE_STATIC);
+    sqlite3_bind_text(stmt,7,xEvent->ChannelID(),-1,SQLITE_STATIC);
 
     if (Source->Trace())
     {
@@ -1479,16 +1712,13 @@ bool cImport::UpdateXMLTVEvent(cEPGSource *Source, sqlite3 *Db, cXMLTVEvent *xEv
         }
     }
 
-    char *errmsg;
-    if (sqlite3_exec(Db,sql,NULL,NULL,&errmsg)!=SQLITE_OK)
+    int ret=sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    if (ret!=SQLITE_DONE)
     {
-        esyslogs(Source,"%s -> %s",sql,errmsg);
-        free(sql);
-        sqlite3_free(errmsg);
+        esyslogs(Source,"sqlite3: %s",sqlite3_errmsg(Db));
         return false;
     }
-
-    free(sql);
     return true;
 }
 
@@ -1496,7 +1726,7 @@ bool cImport::UpdateXMLTVEvent(cEPGSource *Source, sqlite3 *Db, const cEvent *Ev
                                const char *Description)
 {
     if (!Source) return false;
-    if (!Db) return false;
+    if (!Db && !writer) return false;
     if (!Event) return false;
     if (!xEvent) return false;
 
@@ -1514,49 +1744,6 @@ bool cImport::UpdateXMLTVEvent(cEPGSource *Source, sqlite3 *Db, const cEvent *Ev
         eventid=true;
     }
 
-    if (!Begin(Source,Db)) return false;
-
-    char *sql=NULL;
-    if (Description)
-    {
-        char *eitdescription=strdup(Description);
-        if (!eitdescription)
-        {
-            esyslogs(Source,"out of memory");
-            return false;
-        }
-
-        std::string ed=eitdescription;
-
-	long unsigned int reps = ed.length();
-        ed = std::regex_replace(ed, std::regex("'"), "''");
-        if (reps != ed.length())
-        {
-            eitdescription=(char *) realloc(eitdescription,ed.size()+1);
-            strcpy(eitdescription,ed.c_str());
-        }
-
-        if (asprintf(&sql,"update epg set eiteventid=%li, eitdescription='%s' where eventid=%li and "
-                     "src='%s' and channelid='%s'",(long int) Event->EventID(),eitdescription,
-                     (long int) xEvent->EventID(),Source->Name(),*Event->ChannelID().ToString())==-1)
-        {
-            free(eitdescription);
-            esyslogs(Source,"out of memory");
-            return false;
-        }
-        free(eitdescription);
-    }
-    else
-    {
-        if (asprintf(&sql,"update epg set eiteventid=%li where eventid=%li and src='%s' and "
-                     "channelid='%s'",(long int) Event->EventID(),(long int) xEvent->EventID(),
-                     Source->Name(),*Event->ChannelID().ToString())==-1)
-        {
-            esyslogs(Source,"out of memory");
-            return false;
-        }
-    }
-
     if (Source->Trace())
     {
         char buf[80]="";
@@ -1577,122 +1764,171 @@ bool cImport::UpdateXMLTVEvent(cEPGSource *Source, sqlite3 *Db, const cEvent *Ev
         }
     }
 
-    char *errmsg;
-    if (sqlite3_exec(Db,sql,NULL,NULL,&errmsg)!=SQLITE_OK)
+    cString channelid=Event->ChannelID().ToString();
+    if (writer) return writer->UpdateEIT(Source->Name(),*channelid,Event->EventID(),xEvent->EventID(),
+                                             Description,xEvent->RowID(),eventid);
+    return UpdateEITEvent(Source,Db,*channelid,Event->EventID(),xEvent->EventID(),Description,
+                          xEvent->RowID(),eventid);
+}
+
+bool cImport::UpdateEITEvent(cEPGSource *Source, sqlite3 *Db, const char *ChannelID, tEventID EITEventID,
+                             tEventID EventID, const char *Description, sqlite3_int64 RowID,
+                             bool NewEITEventID)
+{
+    if (!Begin(Source,Db)) return false;
+
+    sqlite3_stmt *stmt=Statement(Db,STMT_UPDATEEIT);
+    if (!stmt) return false;
+    sqlite3_bind_int64(stmt,1,EITEventID);
+    if (Description) cXMLTVCompressor::Bind(stmt,2,Description);
+    sqlite3_bind_int64(stmt,3,EventID);
+    sqlite3_bind_text(stmt,4,Source->Name(),-1,SQLITE_STATIC);
+    sqlite3_bind_text(stmt,5,ChannelID,-1,SQLITE_STATIC);
+
+    int ret=sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    if (ret!=SQLITE_DONE)
     {
-        esyslogs(Source,"%s -> %s",sql,errmsg);
-        free(sql);
-        sqlite3_free(errmsg);
+        esyslogs(Source,"sqlite3: %s",sqlite3_errmsg(Db));
         return false;
     }
-
-    free(sql);
+    if (NewEITEventID) g->XMLTVCache()->SetEITEventID(ChannelID,RowID,EITEventID);
     return true;
 }
 
-cXMLTVEvent *cImport::SearchXMLTVEvent(sqlite3 **Db,const char *ChannelID, const cEvent *Event)
+bool cImport::Open(sqlite3 **Db)
 {
-    if (!Event) return NULL;
-    if (!Db) return NULL;
-    if (!*Db)
+    if (!Db) return false;
+    if (*Db) return true;
+    // we need READWRITE because the epg.db maybe updated later
+    if (!(*Db=cEPGDatabase::Open(g->EPGFile())))
     {
-        // we need READWRITE because the epg.db maybe updated later
-        if (sqlite3_open_v2(g->EPGFile(),Db,SQLITE_OPEN_READWRITE,NULL)!=SQLITE_OK)
-        {
-            esyslog("failed to open %s",g->EPGFile());
-            *Db=NULL;
-            return NULL;
-        }
+        esyslog("failed to open %s",g->EPGFile());
+        return false;
     }
+    return true;
+}
 
-    cXMLTVEvent *xevent=NULL;
-    char *sql=NULL;
-
+static int EventTimeDiff(const cEvent *Event)
+{
     int eventTimeDiff=0;
     if (Event->Duration()) eventTimeDiff=Event->Duration()/4;
     if (eventTimeDiff<100) eventTimeDiff=100;
     if (eventTimeDiff>720) eventTimeDiff=720;
+    return eventTimeDiff;
+}
 
-    if (asprintf(&sql,"select channelid,eventid,starttime,duration,title,origtitle,shorttext,description," \
-                 "country,year,credits,category,review,rating,starrating,video,audio,season,episode," \
-                 "episodeoverall,pics,src,eiteventid,eitdescription,alttitle,abs(starttime-%li) as diff from epg where " \
-                 " (starttime>=%li and starttime<=%li) and eiteventid=%u and channelid='%s' " \
-                 " order by diff,srcidx asc limit 1;",Event->StartTime(),Event->StartTime()-eventTimeDiff,
-                 Event->StartTime()+eventTimeDiff,Event->EventID(),ChannelID)==-1)
+int cImport::SearchXMLTVEvents(cEPGSource *Source, sqlite3 **Db, int Count, const char *const *ChannelIDs,
+                               const cEvent *const *Events, cXMLTVEvent **XEvents)
+{
+    if (!Count) return 0;
+    if (!ChannelIDs || !Events || !XEvents) return -1;
+    for (int i=0; i<Count; i++) XEvents[i]=NULL;
+    if (!Open(Db)) return -1;
+
+    // all timer events go into one temp table, which is joined once against epg
+    char *errmsg;
+    if (sqlite3_exec(*Db,TIMER_TABLE,NULL,NULL,&errmsg)!=SQLITE_OK)
     {
-        esyslog("out of memory");
-        return NULL;
+        esyslogs(Source,"sqlite3: %s",errmsg);
+        sqlite3_free(errmsg);
+        return -1;
     }
+    if (!Begin(Source,*Db)) return -1;
 
-    xevent=PrepareAndReturn(Db,sql);
-    if (xevent) return xevent;
-
-    bool bUseRawTitle=false;
-    if (g->SoundEx())
+    char wstr[128];
+    for (int i=0; i<Count; i++)
     {
-        char wstr[128];
-        if (SoundEx((char *) &wstr,(char *) Event->Title(),0,1)==0)
+        sqlite3_stmt *stmt=Statement(*Db,STMT_TIMERADD);
+        if (!stmt) return -1;
+        const cEvent *Event=Events[i];
+        int eventTimeDiff=EventTimeDiff(Event);
+        bool soundex=(g->SoundEx() && SoundEx((char *) &wstr,(char *) Event->Title(),0,1));
+        sqlite3_bind_int(stmt,1,i);
+        sqlite3_bind_text(stmt,2,ChannelIDs[i],-1,SQLITE_STATIC);
+        sqlite3_bind_int64(stmt,3,Event->EventID());
+        sqlite3_bind_int64(stmt,4,Event->StartTime());
+        sqlite3_bind_int64(stmt,5,Event->StartTime()-eventTimeDiff);
+        sqlite3_bind_int64(stmt,6,Event->StartTime()+eventTimeDiff);
+        sqlite3_bind_text(stmt,7,Event->Title(),-1,SQLITE_STATIC);
+        if (soundex)
         {
-            bUseRawTitle=true;
+            sqlite3_bind_text(stmt,8,wstr,-1,SQLITE_TRANSIENT);
         }
         else
         {
-
-            if (asprintf(&sql,"select channelid,eventid,starttime,duration,title,origtitle,shorttext,description," \
-                         "country,year,credits,category,review,rating,starrating,video,audio,season,episode," \
-                         "episodeoverall,pics,src,eiteventid,eitdescription,alttitle,abs(starttime-%li) as diff from epg where " \
-                         " (starttime>=%li and starttime<=%li) and soundex(title)='%s' and channelid='%s' " \
-                         " order by diff,srcidx asc limit 1;",Event->StartTime(),Event->StartTime()-eventTimeDiff,
-                         Event->StartTime()+eventTimeDiff,wstr,ChannelID)==-1)
-            {
-                esyslog("out of memory");
-                return NULL;
-            }
+            sqlite3_bind_null(stmt,8);
+        }
+        int ret=sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if (ret!=SQLITE_DONE)
+        {
+            esyslogs(Source,"sqlite3: %s",sqlite3_errmsg(*Db));
+            return -1;
         }
     }
-    else
+
+    sqlite3_stmt *stmt=SearchStatement(Db,STMT_TIMERMATCH);
+    if (!stmt) return -1;
+
+    // rows are sorted by timer, best match first
+    int found=0;
+    while (sqlite3_step(stmt)==SQLITE_ROW)
     {
-        bUseRawTitle=true;
+        int idx=sqlite3_column_int(stmt,XMLTV_KEYCOLS);
+        if ((idx<0) || (idx>=Count) || (XEvents[idx])) continue;
+        XEvents[idx] = new cXMLTVEvent();
+        FetchXMLTVEvent(stmt,XEvents[idx],0,XMLTV_KEYCOLS);
+        found++;
     }
+    sqlite3_reset(stmt);
+    return found;
+}
+
+cXMLTVEvent *cImport::SearchXMLTVEvent(sqlite3 **Db,const char *ChannelID, const cEvent *Event)
+{
+    if (!Event) return NULL;
+    if (!Open(Db)) return NULL;
 
-    if (bUseRawTitle)
+    int eventTimeDiff=EventTimeDiff(Event);
+
+    sqlite3_int64 rowid=g->XMLTVCache()->Lookup(*Db,ChannelID,Event,eventTimeDiff);
+    if (!rowid) return NULL; // not in cache -> not in db
+    if (rowid>0)
     {
-        char *sqltitle=strdup(Event->Title());
-        if (!sqltitle)
-        {
-            esyslog("out of memory");
-            return NULL;
-        }
+        sqlite3_stmt *stmt=SearchStatement(Db,STMT_BYROWID);
+        if (!stmt) return NULL;
+        sqlite3_bind_int64(stmt,1,rowid);
+        cXMLTVEvent *xevent=StepAndReturn(stmt);
+        if (xevent) return xevent;
+        g->XMLTVCache()->Invalidate(ChannelID); // cache is outdated
+    }
 
-        std::string st=sqltitle;
+    // 1st with eiteventid, 2nd with (soundex of) title
+    char wstr[128];
+    int key=STMT_BYTITLE;
+    if (g->SoundEx() && SoundEx((char *) &wstr,(char *) Event->Title(),0,1)) key=STMT_BYSOUNDEX;
 
-        long unsigned int reps = st.length();
-        st = std::regex_replace(st, std::regex("'"), "''");
-        if (reps != st.length())
+    for (int i=0; i<2; i++)
+    {
+        sqlite3_stmt *stmt=SearchStatement(Db,i ? key : STMT_BYEITEVENTID);
+        if (!stmt) return NULL;
+        sqlite3_bind_int64(stmt,1,Event->StartTime());
+        sqlite3_bind_int64(stmt,2,Event->StartTime()-eventTimeDiff);
+        sqlite3_bind_int64(stmt,3,Event->StartTime()+eventTimeDiff);
+        if (!i)
         {
-            char *tmp_sqltitle=(char *) realloc(sqltitle,st.size()+1);
-            if (tmp_sqltitle)
-            {
-                sqltitle=tmp_sqltitle;
-                strcpy(sqltitle,st.c_str());
-            }
+            sqlite3_bind_int64(stmt,4,Event->EventID());
         }
-
-        if (asprintf(&sql,"select channelid,eventid,starttime,duration,title,origtitle,shorttext,description," \
-                     "country,year,credits,category,review,rating,starrating,video,audio,season,episode," \
-                     "episodeoverall,pics,src,eiteventid,eitdescription,abs(starttime-%li) as diff from epg where " \
-                     " (starttime>=%li and starttime<=%li) and title='%s' and channelid='%s' " \
-                     " order by diff,srcidx asc limit 1;",Event->StartTime(),Event->StartTime()-eventTimeDiff,
-                     Event->StartTime()+eventTimeDiff,sqltitle,ChannelID)==-1)
+        else
         {
-            free(sqltitle);
-            esyslog("out of memory");
-            return NULL;
+            sqlite3_bind_text(stmt,4,key==STMT_BYSOUNDEX ? wstr : Event->Title(),-1,SQLITE_STATIC);
         }
-        free(sqltitle);
+        sqlite3_bind_text(stmt,5,ChannelID,-1,SQLITE_STATIC);
+        cXMLTVEvent *xevent=StepAndReturn(stmt);
+        if (xevent) return xevent;
     }
-
-    return PrepareAndReturn(Db,sql);
+    return NULL;
 }
 
 bool cImport::Begin(cEPGSource *Source, sqlite3 *Db)
@@ -1733,6 +1969,9 @@ bool cImport::Commit(cEPGSource *Source, sqlite3 *Db)
                 esyslog("sqlite3: COMMIT -> %s",errmsg);
             }
             sqlite3_free(errmsg);
+            // a failed COMMIT may leave the transaction open
+            if (!sqlite3_get_autocommit(Db)) sqlite3_exec(Db,"ROLLBACK",NULL,NULL,NULL);
+            pendingtransaction=false;
             return false;
         }
         pendingtransaction=false;
@@ -1740,9 +1979,120 @@ bool cImport::Commit(cEPGSource *Source, sqlite3 *Db)
     return true;
 }
 
-int cImport::Process(cEPGSource *Source, cEPGExecutor &myExecutor)
+char *cImport::ChannelFilter(cEPGSource *Source, sqlite3 *Db, const cSchedules *Schedules, const char *SrcList,
+                             bool Full, time_t Begin, uint64_t Setup, std::vector<watermark> &Pending)
+{
+    if (!SrcList) return NULL;
+    char *sql;
+    if (asprintf(&sql,"select src,channelid,modified,applied,appliedend,setup from watermarks where src in (%s);",
+                 SrcList)==-1) return NULL;
+
+    sqlite3_stmt *stmt;
+    int ret=sqlite3_prepare_v2(Db,sql,strlen(sql),&stmt,NULL);
+    free(sql);
+    if (ret!=SQLITE_OK)
+    {
+        esyslogs(Source,"%i %s (p)",ret,sqlite3_errmsg(Db));
+        return NULL;
+    }
+
+    // the oldest import window end of all sources, 0 if one was never imported
+    time_t lastend=-1;
+    bool setupchanged=false;
+    std::set<std::string> changed;
+    while (sqlite3_step(stmt)==SQLITE_ROW)
+    {
+        const char *src=(const char *) sqlite3_column_text(stmt,0);
+        const char *channelid=(const char *) sqlite3_column_text(stmt,1);
+        if (!src || !channelid) continue;
+        watermark mark;
+        mark.src=src;
+        mark.channelid=channelid;
+        mark.modified=sqlite3_column_int(stmt,2);
+        Pending.push_back(mark);
+
+        time_t appliedend=(time_t) sqlite3_column_int64(stmt,4);
+        if ((lastend==-1) || (appliedend<lastend)) lastend=appliedend;
+        // applied with another setup -> all events may look different now
+        if ((sqlite3_column_type(stmt,5)==SQLITE_NULL) || (sqlite3_column_int64(stmt,5)!=(sqlite3_int64) Setup))
+            setupchanged=true;
+        if ((sqlite3_column_type(stmt,3)==SQLITE_NULL) || (sqlite3_column_int(stmt,3)!=mark.modified))
+        {
+            changed.insert(channelid);
+            continue;
+        }
+        // schedule cleared (e.g. by CLRE) since the last import
+        const cSchedule *schedule=Schedules->GetSchedule(tChannelID::FromString(channelid));
+        const cEvent *last=schedule ? schedule->Events()->Last() : NULL;
+        if (!last || (last->EndTime()<=Begin)) changed.insert(channelid);
+    }
+    sqlite3_finalize(stmt);
+
+    // first import, forced or setup changed -> import everything
+    if (Full || setupchanged || (lastend<=0)) return NULL;
+
+    char *channels=NULL;
+    for (std::set<std::string>::iterator it=changed.begin(); it!=changed.end(); ++it)
+    {
+        if (channels) channels=strcatrealloc(channels,",");
+        channels=strcatrealloc(channels,"'");
+        channels=strcatrealloc(channels,it->c_str());
+        channels=strcatrealloc(channels,"'");
+    }
+    dsyslogs(Source,"%i channels changed since last import",(int) changed.size());
+
+    // changed channels and events which moved into the import window
+    char *filter;
+    if (asprintf(&filter,"channelid in (%s) or endtime >= %li",
+                 channels ? channels : "NULL",lastend)==-1) filter=NULL;
+    free(channels);
+    return filter;
+}
+
+bool cImport::SaveWatermarks(cEPGSource *Source, sqlite3 *Db, std::vector<watermark> &Pending, time_t End,
+                             uint64_t Setup)
+{
+    if (Pending.empty()) return true;
+    if (!Begin(Source,Db)) return false;
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(Db,"update watermarks set applied=?3, appliedend=?4, setup=?5 " \
+                           "where src=?1 and channelid=?2;",
+                           -1,&stmt,NULL)!=SQLITE_OK)
+    {
+        esyslogs(Source,"sqlite3: %s",sqlite3_errmsg(Db));
+        return false;
+    }
+    bool ok=true;
+    for (std::vector<watermark>::iterator it=Pending.begin(); it!=Pending.end(); ++it)
+    {
+        sqlite3_bind_text(stmt,1,it->src.c_str(),-1,SQLITE_STATIC);
+        sqlite3_bind_text(stmt,2,it->channelid.c_str(),-1,SQLITE_STATIC);
+        sqlite3_bind_int(stmt,3,it->modified);
+        sqlite3_bind_int64(stmt,4,End);
+        sqlite3_bind_int64(stmt,5,(sqlite3_int64) Setup);
+        int ret=sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if (ret!=SQLITE_DONE)
+        {
+            esyslogs(Source,"sqlite3: %s",sqlite3_errmsg(Db));
+            ok=false;
+            break;
+        }
+    }
+    sqlite3_finalize(stmt);
+    return ok;
+}
+
+int cImport::Process(cEPGSource *Source, cEPGExecutor &myExecutor, cEPGSources *Sources, bool Full)
 {
     if (!Source) return 0;
+    if (Sources && (sqlite3_libversion_number()<3025000))
+    {
+        // window functions are needed to merge the sources
+        isyslogs(Source,"sqlite3 %s cannot merge sources, importing from this source only",
+                 sqlite3_libversion());
+        Sources=NULL;
+    }
     time_t begin=time(NULL);
     time_t end=begin+(Source->DaysInAdvance()*86400);
 #if VDRVERSNUM < 10726 && (!EPGHANDLER)
@@ -1818,7 +2168,7 @@ int cImport::Process(cEPGSource *Source, cEPGExecutor &myExecutor)
 
     dsyslogs(Source,"importing from db");
     sqlite3 *db=NULL;
-    if (sqlite3_open_v2(g->EPGFile(),&db,SQLITE_OPEN_READWRITE,NULL)!=SQLITE_OK)
+    if (!(db=cEPGDatabase::Open(g->EPGFile())))
     {
         esyslogs(Source,"failed to open %s",g->EPGFile());
 #if VDRVERSNUM<20301
@@ -1831,14 +2181,60 @@ int cImport::Process(cEPGSource *Source, cEPGExecutor &myExecutor)
         return 141;
     }
 
+// same order as XMLTV_KEYS, the import never used alttitle
+// ephash covers the episode updates of the EIT handler, they leave datahash alone
+#define IMPORT_COLUMNS "channelid,eventid,starttime,duration,title,NULL as alttitle,src,eiteventid," \
+                "rowid as xrowid,datahash,xmltv_hash(eitdescription) as eithash," \
+                "xmltv_hash(coalesce(shorttext,'')||'|'||coalesce(season,0)||'|'||coalesce(episode,0)||'|'||" \
+                "coalesce(episodeoverall,0)) as ephash"
+#define IMPORT_NAMES "channelid,eventid,starttime,duration,title,alttitle,src,eiteventid,xrowid,datahash,eithash,ephash"
+
+    char *srclist=NULL;
+    if (Sources)
+    {
+        int srccnt=0;
+        for (cEPGSource *epgs=Sources->First(); epgs; epgs=Sources->Next(epgs))
+        {
+            if (epgs->LastRetCode()) continue;
+            if (srclist) srclist=strcatrealloc(srclist,",");
+            srclist=strcatrealloc(srclist,"'");
+            srclist=strcatrealloc(srclist,epgs->Name());
+            srclist=strcatrealloc(srclist,"'");
+            srccnt++;
+        }
+        dsyslogs(Source,"merging %i sources",srccnt);
+    }
+    else
+    {
+        if (asprintf(&srclist,"'%s'",Source->Name())==-1) srclist=NULL;
+    }
+
+    uint64_t setup=SetupHash();
+    std::vector<watermark> pending;
+    char *filter=ChannelFilter(Source,db,schedules,srclist,Full,begin,setup,pending);
+
     char *sql;
-    if (asprintf(&sql,"select channelid,eventid,starttime,duration,title,origtitle,shorttext,description," \
-                 "country,year,credits,category,review,rating,starrating,video,audio,season,episode,episodeoverall," \
-                 "pics,src,eiteventid,eitdescription from epg where (starttime > %li or " \
-                 " (starttime + duration) > %li) and (starttime + duration) < %li "\
-                 " and src='%s' order by channelid,starttime;",begin,begin,end,Source->Name())==-1)
+    int ret;
+    if (Sources)
     {
-        sqlite3_close(db);
+        // pick the best row per channel and starttime according to the source order
+        ret=asprintf(&sql,"select " IMPORT_NAMES " from (select " IMPORT_COLUMNS ",row_number() over " \
+                     "(partition by channelid,starttime order by srcidx) as rn from epg where endtime > %li and " \
+                     "endtime < %li and src in (%s)%s%s%s) where rn=1 order by channelid,starttime;",begin,end,
+                     srclist ? srclist : "NULL",filter ? " and (" : "",filter ? filter : "",filter ? ")" : "");
+    }
+    else
+    {
+        // endtime>begin also covers starttime>begin
+        ret=asprintf(&sql,"select " IMPORT_COLUMNS " from epg where endtime > %li and endtime < %li "\
+                     " and src in (%s)%s%s%s order by channelid,starttime;",begin,end,
+                     srclist ? srclist : "NULL",filter ? " and (" : "",filter ? filter : "",filter ? ")" : "");
+    }
+    free(srclist);
+    free(filter);
+    if (ret==-1)
+    {
+        Close(db);
         esyslogs(Source,"out of memory");
 #if VDRVERSNUM<20301
         delete schedulesLock;
@@ -1851,11 +2247,11 @@ int cImport::Process(cEPGSource *Source, cEPGExecutor &myExecutor)
     }
 
     sqlite3_stmt *stmt;
-    int ret=sqlite3_prepare_v2(db,sql,strlen(sql),&stmt,NULL);
+    ret=sqlite3_prepare_v2(db,sql,strlen(sql),&stmt,NULL);
     if (ret!=SQLITE_OK)
     {
         esyslogs(Source,"%i %s (p)",ret,sqlite3_errmsg(db));
-        sqlite3_close(db);
+        Close(db);
         free(sql);
 #if VDRVERSNUM<20301
         delete schedulesLock;
@@ -1868,26 +2264,58 @@ int cImport::Process(cEPGSource *Source, cEPGExecutor &myExecutor)
     }
     free(sql);
 
+    // forget applied states of events which are already over
+    for (std::map<uint64_t,appliedstate>::iterator it=applied.begin(); it!=applied.end(); )
+    {
+        if (it->second.end<begin)
+            applied.erase(it++);
+        else
+            ++it;
+    }
+
+    uint64_t inputbase=HashInt(EPListsModified(),g->SetupGeneration());
+
     int lerr=0;
-    int cnt=0;
+    int cnt=0,skipped=0;
     char *lastChannelID=NULL;
     int flags=0,hint=0;
     bool addevents=false;
+    bool modified=false;
+    uint64_t channelhash=0;
     cSchedule* schedule=NULL;
+    std::map<const cEvent *,int> merged;
     for (;;)
     {
         if (sqlite3_step(stmt)==SQLITE_ROW)
         {
             cXMLTVEvent xevent;
-            if (FetchXMLTVEvent(stmt,&xevent))
+            if (FetchXMLTVEvent(stmt,&xevent,0,XMLTV_KEYCOLS))
             {
+                cEPGSource *source=Source;
+                if (Sources)
+                {
+                    source=Sources->GetSource(xevent.Source());
+                    if (!source) source=Source;
+                }
                 if (!lastChannelID || strcmp(lastChannelID,xevent.ChannelID()))
                 {
+                    merged.clear();
+                    scheduleindex.Flush();
+                    if (schedule && modified)
+                    {
+#if VDRVERSNUM>=20301
+                        schedule->SetModified();
+#else
+                        schedules->SetModified(schedule);
+#endif
+                    }
+                    schedule=NULL;
+                    modified=false;
                     cEPGMapping *map=g->EPGMappings()->GetMap(tChannelID::FromString(xevent.ChannelID()));
                     if (!map)
                     {
                         if (lerr!=IMPORT_NOMAPPING)
-                            esyslogs(Source,"no mapping for channelid %s",xevent.ChannelID());
+                            esyslogs(source,"no mapping for channelid %s",xevent.ChannelID());
                         lerr=IMPORT_NOMAPPING;
                         if (lastChannelID)
                         {
@@ -1909,7 +2337,7 @@ int cImport::Process(cEPGSource *Source, cEPGExecutor &myExecutor)
                     if (!channel)
                     {
                         if (lerr!=IMPORT_NOCHANNEL)
-                            esyslogs(Source,"channel %s not found in channels.conf",
+                            esyslogs(source,"channel %s not found in channels.conf",
                                      xevent.ChannelID());
                         lerr=IMPORT_NOCHANNEL;
                         if (lastChannelID)
@@ -1924,7 +2352,7 @@ int cImport::Process(cEPGSource *Source, cEPGExecutor &myExecutor)
                     if (!schedule)
                     {
                         if (lerr!=IMPORT_NOSCHEDULE)
-                            esyslogs(Source,"cannot get schedule for channel %s%s",
+                            esyslogs(source,"cannot get schedule for channel %s%s",
                                      channel->Name(),addevents ? "" : " - try add option");
                         lerr=IMPORT_NOSCHEDULE;
                         if (lastChannelID)
@@ -1936,10 +2364,11 @@ int cImport::Process(cEPGSource *Source, cEPGExecutor &myExecutor)
                     }
                     if (lastChannelID) free(lastChannelID);
                     lastChannelID=strdup(xevent.ChannelID());
+                    channelhash=HashStr(lastChannelID);
                     hint=0;
                 }
 
-                cEvent *event=SearchVDREvent(Source, schedule, &xevent, addevents, hint);
+                cEvent *event=SearchVDREvent(source, schedule, &xevent, addevents, hint);
 
                 if (!addevents)
                 {
@@ -1956,7 +2385,7 @@ int cImport::Process(cEPGSource *Source, cEPGExecutor &myExecutor)
                 {
                     if (event && (event->EventID() != xevent.EventID()))
                     {
-                        tsyslogs(Source,"{%5i} changing existing eventid to {%5i}",event->EventID(),xevent.EventID());
+                        tsyslogs(source,"{%5i} changing existing eventid to {%5i}",event->EventID(),xevent.EventID());
                         event->SetEventID(xevent.EventID());
                         event->SetVersion(0);
                         event->SetTableID(0);
@@ -1966,15 +2395,46 @@ int cImport::Process(cEPGSource *Source, cEPGExecutor &myExecutor)
 #if VDRVERSNUM < 10726 && (!EPGHANDLER)
                 if ((!addevents) && (xevent.StartTime()>endoneday)) continue;
 #endif
-                if (PutEvent(Source, db, schedule, event, &xevent, flags))
+                if (Sources && event)
                 {
-#if VDRVERSNUM>=20301
-                    schedule->SetModified();
-#else
-                    schedules->SetModified(schedule);
-#endif
+                    // starttimes differ between sources, keep the event of the better one
+                    std::map<const cEvent *,int>::iterator it=merged.find(event);
+                    if ((it!=merged.end()) && (it->second<source->Index())) continue;
+                    merged[event]=source->Index();
+                }
+
+                uint64_t input=0,key=0;
+                if (event)
+                {
+                    // skip events which still hold what we applied last time, datahash covers
+                    // the parsed data, eiteventid, eithash and ephash the EIT updates
+                    input=HashInt(sqlite3_column_int64(stmt,XMLTV_KEYCOLS),xevent.EITEventID());
+                    input=HashInt(sqlite3_column_int64(stmt,XMLTV_KEYCOLS+1),input);
+                    input=HashInt(sqlite3_column_int64(stmt,XMLTV_KEYCOLS+2),input);
+                    input=HashInt(flags,HashInt(inputbase,input));
+                    key=HashInt(event->EventID(),channelhash);
+                    std::map<uint64_t,appliedstate>::iterator it=applied.find(key);
+                    if ((it!=applied.end()) && (it->second.input==input) &&
+                            (it->second.state==StateHash(event)))
+                    {
+                        skipped++;
+                        continue;
+                    }
+                }
+                bool done=false;
+                if (PutEvent(source, db, schedule, event, &xevent, flags, &done))
+                {
+                    modified=true;
                     cnt++;
                 }
+                if (event && done)
+                {
+                    appliedstate state;
+                    state.input=input;
+                    state.state=StateHash(event);
+                    state.end=event->EndTime();
+                    applied[key]=state;
+                }
             }
         }
         else
@@ -1982,6 +2442,20 @@ int cImport::Process(cEPGSource *Source, cEPGExecutor &myExecutor)
             break;
         }
     }
+    scheduleindex.Flush();
+    if (schedule && modified)
+    {
+#if VDRVERSNUM>=20301
+        schedule->SetModified();
+#else
+        schedules->SetModified(schedule);
+#endif
+    }
+    if (lastChannelID) free(lastChannelID);
+
+    // remember what we have applied for the next incremental import,
+    // the watermarks are committed together with the event updates
+    if (myExecutor.StillRunning()) SaveWatermarks(Source,db,pending,end,setup);
 
     if (Commit(Source,db))
     {
@@ -2007,16 +2481,19 @@ int cImport::Process(cEPGSource *Source, cEPGExecutor &myExecutor)
                 isyslogs(Source,"processed no vdr events - see ERRORs above!");
             }
         }
+        if (skipped) dsyslogs(Source,"skipped %i unchanged vdr events",skipped);
     }
 
+    g->XMLTVCache()->ClearMisses();
+
     sqlite3_finalize(stmt);
-    sqlite3_close(db);
+    Close(db);
 #if VDRVERSNUM<20301
     delete schedulesLock;
     Timers.SetEvents();
     Timers.DecBeingEdited();
 #else
-    StateKey.Remove();
+    StateKey.Remove(cnt>0);
     StateKeyChan.Remove();
 #endif
     return 0;
@@ -2035,6 +2512,10 @@ cImport::cImport(cGlobals *Global)
 {
     g=Global;
     pendingtransaction=false;
+    writer=NULL;
+    stmtdb=NULL;
+    for (int i=0; i<MAXSTMTS; i++) stmts[i]=NULL;
+    plansetup=-1;
     conv = new cCharSetConv("UTF-8",g->Codeset());
 
     if (Global->EPDir())
@@ -2051,6 +2532,7 @@ cImport::cImport(cGlobals *Global)
 
 cImport::~cImport()
 {
+    FinalizeStatements();
     if (cep2ascii!=(iconv_t) -1) iconv_close(cep2ascii);
     if (cutf2ascii!=(iconv_t) -1) iconv_close(cutf2ascii);
     delete conv;
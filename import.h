@@ -11,14 +11,39 @@
 #include <vdr/epg.h>
 #include <vdr/channels.h>
 #include <sqlite3.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
 
 #include "event.h"
 #include "source.h"
 #include "maps.h"
 
 class cEPGSource;
+class cEPGSources;
 class cEPGExecutor;
 class cGlobals;
+class cXMLTVWriter;
+
+class cScheduleIndex
+{
+private:
+    cSchedule *schedule;
+    std::multimap<time_t,cEvent *> events;
+    bool needsort;
+public:
+    cScheduleIndex()
+    {
+        schedule=NULL;
+        needsort=false;
+    }
+    void Build(cSchedule *Schedule);
+    void Flush();
+    void Add(cEvent *Event);
+    cEvent *Predecessor(time_t Start, cEvent **Next);
+    bool IsFree(time_t Start, time_t End);
+};
 
 class cImport
 {
@@ -38,6 +63,39 @@ private:
         IMPORT_NOCHANNELID,
         IMPORT_EMPTYSCHEDULE
     };
+    typedef char *(cImport::*addsection)(char *description, cXMLTVEvent *xEvent, int Flags);
+    enum
+    {
+        MAXSECTIONS=32
+    };
+    struct descplan
+    {
+        addsection add[MAXSECTIONS];
+        int count;
+    };
+    std::map<int,descplan> plans;
+    int plansetup;
+    const descplan *GetDescPlan(int Flags);
+    struct appliedstate
+    {
+        uint64_t input;
+        uint64_t state;
+        time_t end;
+    };
+    std::map<uint64_t,appliedstate> applied;
+    uint64_t StateHash(const cEvent *Event);
+    time_t EPListsModified();
+    uint64_t SetupHash();
+    struct watermark
+    {
+        std::string src;
+        std::string channelid;
+        int modified;
+    };
+    char *ChannelFilter(cEPGSource *Source, sqlite3 *Db, const cSchedules *Schedules, const char *SrcList,
+                        bool Full, time_t Begin, uint64_t Setup, std::vector<watermark> &Pending);
+    bool SaveWatermarks(cEPGSource *Source, sqlite3 *Db, std::vector<watermark> &Pending, time_t End,
+                        uint64_t Setup);
     cGlobals *g;
     cCharSetConv *conv;
     iconv_t cep2ascii;
@@ -47,35 +105,81 @@ private:
     char *Add2Description(char *description, const char *value);
     char *Add2Description(char *description, const char *name, const char *value);
     char *Add2Description(char *description, const char *name, int value);
-    char *Add2Description(char *description, cXMLTVEvent *xEvent, int Flags, int what);
+    char *AddLongText2Description(char *description, cXMLTVEvent *xEvent, int Flags);
+    char *AddCredits2Description(char *description, cXMLTVEvent *xEvent, int Flags);
+    char *AddCountryDate2Description(char *description, cXMLTVEvent *xEvent, int Flags);
+    char *AddOrigTitle2Description(char *description, cXMLTVEvent *xEvent, int Flags);
+    char *AddCategories2Description(char *description, cXMLTVEvent *xEvent, int Flags);
+    char *AddVideo2Description(char *description, cXMLTVEvent *xEvent, int Flags);
+    char *AddAudio2Description(char *description, cXMLTVEvent *xEvent, int Flags);
+    char *AddSeason2Description(char *description, cXMLTVEvent *xEvent, int Flags);
+    char *AddRating2Description(char *description, cXMLTVEvent *xEvent, int Flags);
+    char *AddStarRating2Description(char *description, cXMLTVEvent *xEvent, int Flags);
+    char *AddReview2Description(char *description, cXMLTVEvent *xEvent, int Flags);
     char *AddEOT2Description(char *description, bool checkutf8=false);
     struct split split(char *in, char delim);
-    cEvent *GetEventBefore(cSchedule* schedule, time_t start);
+    cScheduleIndex scheduleindex;
     cEvent *SearchVDREvent(cEPGSource *source, cSchedule* schedule, cXMLTVEvent *event, bool append, int hint);
     cEvent *SearchVDREventByTitle(cEPGSource *source, cSchedule* schedule, const char *Title, time_t StartTime,
                                   int Duration, int hint);
-    bool FetchXMLTVEvent(sqlite3_stmt *stmt, cXMLTVEvent *xevent);
+    bool FetchXMLTVEvent(sqlite3_stmt *stmt, cXMLTVEvent *xevent, int First=0, int Count=-1);
     char *RemoveNonASCII(const char *src);
-    cXMLTVEvent *PrepareAndReturn(sqlite3 **db, char *sql);
-    int SoundEx(char *SoundEx,char *WordString,int LengthOption,int CensusOption);
+    enum
+    {
+        STMT_BYROWID=0,
+        STMT_BYEITEVENTID,
+        STMT_BYSOUNDEX,
+        STMT_BYTITLE,
+        STMT_INSERT,
+        STMT_UPDATE,
+        STMT_UPDATEEPISODE,
+        STMT_UPDATEEIT,
+        STMT_TIMERADD,
+        STMT_TIMERMATCH,
+        STMT_HEAVY,
+        MAXSTMTS
+    };
+    sqlite3 *stmtdb;
+    sqlite3_stmt *stmts[MAXSTMTS];
+    sqlite3_stmt *Statement(sqlite3 *Db, int Which);
+    sqlite3_stmt *SearchStatement(sqlite3 **Db, int Which);
+    void FinalizeStatements();
+    bool Open(sqlite3 **Db);
+    cXMLTVEvent *StepAndReturn(sqlite3_stmt *stmt);
+    cXMLTVWriter *writer;
+    cXMLTVEvent *NewXMLTVEvent(const cEvent *Event, const char *EITDescription, const char *AltTitle,
+                               const char *ShortText, int Season, int Episode, int EpisodeOverall);
 public:
+    static int SoundEx(char *SoundEx,char *WordString,int LengthOption,int CensusOption);
     cImport(cGlobals *Global);
     ~cImport();
     void LinkPictures(const char *Source, cXMLTVStringList *Pics, tEventID DestID,
                       tChannelID ChanID, bool MakeOld=true);
-    int Process(cEPGSource *Source, cEPGExecutor &myExecutor);
+    int Process(cEPGSource *Source, cEPGExecutor &myExecutor, cEPGSources *Sources=NULL,
+                bool Full=false);
+    void Close(sqlite3 *Db);
     bool Begin(cEPGSource *Source, sqlite3 *Db);
     bool Commit(cEPGSource *Source, sqlite3 *Db);
     bool DBExists();
     bool PutEvent(cEPGSource *Source, sqlite3 *Db, cSchedule* Schedule, cEvent *Event,
-                  cXMLTVEvent *xEvent, int Flags);
+                  cXMLTVEvent *xEvent, int Flags, bool *Applied=NULL);
     bool UpdateXMLTVEvent(cEPGSource *Source, sqlite3 *Db, cXMLTVEvent *xEvent);
     bool UpdateXMLTVEvent(cEPGSource *Source, sqlite3 *Db, const cEvent *Event, cXMLTVEvent *xEvent,
                           const char *Description);
+    bool UpdateEITEvent(cEPGSource *Source, sqlite3 *Db, const char *ChannelID, tEventID EITEventID,
+                        tEventID EventID, const char *Description, sqlite3_int64 RowID, bool NewEITEventID);
+    void SetWriter(cXMLTVWriter *Writer)
+    {
+        writer=Writer;
+    }
     cXMLTVEvent *SearchXMLTVEvent(sqlite3 **Db, const char *ChannelID, const cEvent *Event);
+    int SearchXMLTVEvents(cEPGSource *Source, sqlite3 **Db, int Count, const char *const *ChannelIDs,
+                          const cEvent *const *Events, cXMLTVEvent **XEvents);
     cXMLTVEvent *AddXMLTVEvent(cEPGSource *Source, sqlite3 *Db, const char *ChannelID,
                                const cEvent *Event, const char *EITDescription, bool UseEPText);
+    bool InsertXMLTVEvent(cEPGSource *Source, sqlite3 *Db, const char *ChannelID, cXMLTVEvent *xEvent);
     bool AddShortTextFromEITDescription(cXMLTVEvent *xEvent, const char *EITDescription);
+    bool LoadXMLTVEvent(sqlite3 *Db, cXMLTVEvent *xEvent);
     bool WasChanged(cEvent *Event);
 };
 
@@ -6,6 +6,7 @@
  */
 
 #include "maps.h"
+#include "event.h"
 #include <limits.h>
 
 cTEXTMapping::cTEXTMapping(const char *Name, const char *Value)
@@ -28,91 +29,158 @@ void cTEXTMapping::ChangeValue(const char *Value)
 
 // --------------------------------------------------------------------------------------------------------
 
+void cTEXTMappings::index(cTEXTMapping *Mapping)
+{
+    if (Mapping->Name()) byname.insert(std::make_pair(std::string(Mapping->Name()),Mapping));
+}
+
+void cTEXTMappings::Add(cTEXTMapping *Mapping)
+{
+    lock.Lock(true);
+    cList<cTEXTMapping>::Add(Mapping);
+    index(Mapping);
+    lock.Unlock();
+}
+
+void cTEXTMappings::Rebuild()
+{
+    lock.Lock(true);
+    byname.clear();
+    for (cTEXTMapping *map=First(); map; map=Next(map)) index(map);
+    lock.Unlock();
+}
+
 void cTEXTMappings::Remove()
 {
+    lock.Lock(true);
+    byname.clear();
     cTEXTMapping *maps;
     while ((maps=Last())!=NULL)
     {
         Del(maps);
     }
+    lock.Unlock();
+}
+
+uint64_t cTEXTMappings::Hash(uint64_t Hash)
+{
+    lock.Lock(false);
+    for (cTEXTMapping *map=First(); map; map=Next(map))
+    {
+        Hash=HashStr(map->Value(),HashStr(map->Name(),Hash));
+    }
+    lock.Unlock();
+    return Hash;
 }
 
 cTEXTMapping* cTEXTMappings::GetMap(const char* Name)
 {
     if (!Name) return NULL;
-    if (!Count()) return NULL;
-    for (int i=0; i<Count();i++)
+    cTEXTMapping *map=NULL;
+    lock.Lock(false);
+    std::unordered_map<std::string,cTEXTMapping *>::iterator it=byname.find(Name);
+    if (it!=byname.end()) map=it->second;
+    lock.Unlock();
+    return map;
+}
+
+
+// --------------------------------------------------------------------------------------------------------
+
+void cEPGMappings::index(cEPGMapping *Mapping)
+{
+    if (Mapping->ChannelName()) byname.insert(std::make_pair(std::string(Mapping->ChannelName()),Mapping));
+    bool append=((Mapping->Flags() & OPT_APPEND)==OPT_APPEND);
+    for (int x=0; x<Mapping->NumChannelIDs(); x++)
     {
-        if (!strcmp(Get(i)->Name(),Name)) return Get(i);
+        // first mapping wins, like the list order did
+        bychannel.insert(std::make_pair(Mapping->ChannelIDs()[x],Mapping));
+        if (append) ignore.insert(Mapping->ChannelIDs()[x]);
     }
-    return NULL;
 }
 
+void cEPGMappings::Add(cEPGMapping *Mapping)
+{
+    // appended mappings never replace an entry, no rebuild needed
+    lock.Lock(true);
+    cList<cEPGMapping>::Add(Mapping);
+    index(Mapping);
+    lock.Unlock();
+}
 
-// --------------------------------------------------------------------------------------------------------
+void cEPGMappings::Rebuild()
+{
+    lock.Lock(true);
+    byname.clear();
+    bychannel.clear();
+    ignore.clear();
+    for (cEPGMapping *map=First(); map; map=Next(map)) index(map);
+    lock.Unlock();
+}
 
-bool cEPGMappings::ProcessChannel(const tChannelID ChannelID)
+uint64_t cEPGMappings::Hash(uint64_t Hash)
 {
-    if (!Count()) return false;
-    for (int i=0; i<Count();i++)
+    lock.Lock(false);
+    for (cEPGMapping *map=First(); map; map=Next(map))
     {
-        for (int x=0; x<Get(i)->NumChannelIDs(); x++)
-        {
-            if (Get(i)->ChannelIDs()[x]==ChannelID) return true;
-        }
+        Hash=HashInt(map->Flags(),HashStr(map->ChannelName(),Hash));
+        for (int i=0; i<map->NumChannelIDs(); i++)
+            Hash=HashStr(*map->ChannelIDs()[i].ToString(),Hash);
     }
-    return false;
+    lock.Unlock();
+    return Hash;
+}
+
+bool cEPGMappings::ProcessChannel(const tChannelID ChannelID)
+{
+    lock.Lock(false);
+    bool ret=(bychannel.find(ChannelID)!=bychannel.end());
+    lock.Unlock();
+    return ret;
 }
 
 bool cEPGMappings::IgnoreChannel(const cChannel *Channel)
 {
     if (!Channel) return false;
-    if (!Count()) return false;
-    tChannelID cid=Channel->GetChannelID();
-    for (int i=0; i<Count();i++)
-    {
-        if ((Get(i)->Flags() & OPT_APPEND)==OPT_APPEND)
-        {
-            for (int x=0; x<Get(i)->NumChannelIDs(); x++)
-            {
-                if (Get(i)->ChannelIDs()[x]==cid) return true;
-            }
-        }
-    }
-    return false;
+    lock.Lock(false);
+    bool ret=(ignore.find(Channel->GetChannelID())!=ignore.end());
+    lock.Unlock();
+    return ret;
 }
 
 void cEPGMappings::Remove()
 {
+    lock.Lock(true);
+    byname.clear();
+    bychannel.clear();
+    ignore.clear();
     cEPGMapping *maps;
     while ((maps=Last())!=NULL)
     {
         Del(maps);
     }
+    lock.Unlock();
 }
 
 cEPGMapping* cEPGMappings::GetMap(const char* ChannelName)
 {
     if (!ChannelName) return NULL;
-    if (!Count()) return NULL;
-    for (int i=0; i<Count();i++)
-    {
-        if (!strcmp(Get(i)->ChannelName(),ChannelName)) return Get(i);
-    }
-    return NULL;
+    cEPGMapping *map=NULL;
+    lock.Lock(false);
+    std::unordered_map<std::string,cEPGMapping *>::iterator it=byname.find(ChannelName);
+    if (it!=byname.end()) map=it->second;
+    lock.Unlock();
+    return map;
 }
 
 cEPGMapping *cEPGMappings::GetMap(tChannelID ChannelID)
 {
-    if (!Count()) return NULL;
-    for (int i=0; i<Count();i++)
-    {
-        for (int x=0; x<Get(i)->NumChannelIDs(); x++)
-        {
-            if (Get(i)->ChannelIDs()[x]==ChannelID) return Get(i);
-        }
-    }
-    return NULL;
+    cEPGMapping *map=NULL;
+    lock.Lock(false);
+    std::unordered_map<tChannelID,cEPGMapping *,channelhash>::iterator it=bychannel.find(ChannelID);
+    if (it!=bychannel.end()) map=it->second;
+    lock.Unlock();
+    return map;
 }
 
 // --------------------------------------------------------------------------------------------------------
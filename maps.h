@@ -10,6 +10,10 @@
 
 #include <vdr/channels.h>
 #include <vdr/tools.h>
+#include <vdr/thread.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
 
 // Flags field definition
 
@@ -67,7 +71,15 @@ public:
 
 class cTEXTMappings : public cList<cTEXTMapping>
 {
+private:
+    // readers of the EIT thread only block while the setup changes
+    cRwLock lock;
+    std::unordered_map<std::string,cTEXTMapping *> byname;
+    void index(cTEXTMapping *Mapping);
 public:
+    void Add(cTEXTMapping *Mapping);
+    void Rebuild();
+    uint64_t Hash(uint64_t Hash);
     cTEXTMapping *GetMap(const char *Name);
     void Remove();
 };
@@ -114,7 +126,25 @@ public:
 
 class cEPGMappings : public cList<cEPGMapping>
 {
+private:
+    struct channelhash
+    {
+        size_t operator()(const tChannelID &ChannelID) const
+        {
+            return ((size_t) ChannelID.Source()*31+ChannelID.Nid())*31*31*31+
+                   (ChannelID.Tid()*31+ChannelID.Sid())*31+ChannelID.Rid();
+        }
+    };
+    // readers of the EIT thread only block while the setup changes
+    cRwLock lock;
+    std::unordered_map<std::string,cEPGMapping *> byname;
+    std::unordered_map<tChannelID,cEPGMapping *,channelhash> bychannel;
+    std::unordered_set<tChannelID,channelhash> ignore;
+    void index(cEPGMapping *Mapping);
 public:
+    void Add(cEPGMapping *Mapping);
+    void Rebuild();
+    uint64_t Hash(uint64_t Hash);
     cEPGMapping *GetMap(const char *ChannelName);
     cEPGMapping *GetMap(tChannelID ChannelID);
     bool ProcessChannel(tChannelID ChannelID);
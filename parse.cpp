@@ -19,11 +19,16 @@
 #include <vdr/timers.h>
 #include <vdr/tools.h>
 #include <sqlite3.h>
+#include <set>
+#include <string>
 
 #include "xmltv2vdr.h"
 #include "parse.h"
 #include "debug.h"
 
+// events per transaction, keeps the write lock short for other writers
+#define PARSE_CHUNK 2000
+
 // -------------------------------------------------------
 
 time_t cParse::ConvertXMLTVTime2UnixTime(char *xmltvtime)
@@ -911,6 +916,61 @@ bool cParse::FetchEvent(xmlNodePtr enode, bool useeptext)
     return xevent.HasTitle();
 }
 
+bool cParse::RaiseWatermarks(sqlite3 *Db, std::set<std::string> &Channels)
+{
+    if (Channels.empty()) return true;
+    // raise the watermark of every channel with new or changed events
+    sqlite3_stmt *wstmt;
+    if (sqlite3_prepare_v2(Db,"INSERT OR REPLACE INTO watermarks (src,channelid,modified,applied,appliedend,setup) " \
+                           "VALUES (?1,?2,max(?3,coalesce((select modified+1 from watermarks where " \
+                           "src=?1 and channelid=?2),0)),(select applied from watermarks where src=?1 and " \
+                           "channelid=?2),(select appliedend from watermarks where src=?1 and channelid=?2)," \
+                           "(select setup from watermarks where src=?1 and channelid=?2));",
+                           -1,&wstmt,NULL)!=SQLITE_OK)
+    {
+        esyslogs(source,"sqlite3: %s",sqlite3_errmsg(Db));
+        return false;
+    }
+    bool ok=true;
+    time_t now=time(NULL);
+    for (std::set<std::string>::iterator it=Channels.begin(); it!=Channels.end(); ++it)
+    {
+        sqlite3_bind_text(wstmt,1,source->Name(),-1,SQLITE_STATIC);
+        sqlite3_bind_text(wstmt,2,it->c_str(),-1,SQLITE_STATIC);
+        sqlite3_bind_int64(wstmt,3,now);
+        int ret=sqlite3_step(wstmt);
+        sqlite3_reset(wstmt);
+        if (ret!=SQLITE_DONE)
+        {
+            esyslogs(source,"sqlite3: %s",sqlite3_errmsg(Db));
+            ok=false;
+            break;
+        }
+    }
+    sqlite3_finalize(wstmt);
+    Channels.clear();
+    return ok;
+}
+
+bool cParse::Checkpoint(sqlite3 *Db, std::set<std::string> &Channels)
+{
+    // watermarks go into the same transaction as their events, a chunk
+    // without them would be skipped by the next incremental import
+    if (!RaiseWatermarks(Db,Channels))
+    {
+        sqlite3_exec(Db,"ROLLBACK",NULL,NULL,NULL);
+        return false;
+    }
+    char *errmsg;
+    if (sqlite3_exec(Db,"COMMIT; BEGIN",NULL,NULL,&errmsg)!=SQLITE_OK)
+    {
+        esyslogs(source,"sqlite3: COMMIT %s",errmsg);
+        sqlite3_free(errmsg);
+        return false;
+    }
+    return true;
+}
+
 int cParse::Process(cEPGExecutor &myExecutor,char *buffer, int bufsize)
 {
     if (!buffer) return 134;
@@ -934,35 +994,70 @@ int cParse::Process(cEPGExecutor &myExecutor,char *buffer, int bufsize)
         return 141;
     }
 
+    bool created=!g->DBExists();
     sqlite3 *db=NULL;
-    if (sqlite3_open(g->EPGFile(),&db)!=SQLITE_OK)
+    if (!(db=cEPGDatabase::Open(g->EPGFile(),SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE)))
     {
         esyslogs(source,"failed to open or create %s",g->EPGFile());
         xmlFreeDoc(xmltv);
         return 141;
     }
 
-    char sql[]="CREATE TABLE IF NOT EXISTS epg (" \
-               "src nvarchar(100), channelid nvarchar(255), eventid int, eiteventid int, "\
-               "starttime datetime, duration int, title nvarchar(255), alttitle nvarchar(255), "\
-               "origtitle nvarchar(255), shorttext nvarchar(255), description text, "\
-               "eitdescription text, country nvarchar(255), year int, " \
-               "credits text, category text, review text, rating text, " \
-               "starrating text, video text, audio text, season int, episode int, " \
-               "episodeoverall int, pics text, srcidx int," \
-               "PRIMARY KEY(eventid, src, channelid)" \
-               ");" \
-               "CREATE INDEX IF NOT EXISTS idx1 on epg (starttime, eiteventid, channelid); " \
-               "CREATE INDEX IF NOT EXISTS idx2 on epg (starttime, title, channelid); " \
-               "CREATE INDEX IF NOT EXISTS idx3 on epg (starttime, duration, src); " \
-               "BEGIN";
+    // older databases first get the new columns, the indexes below refer to them
+    if (!cEPGDatabase::Migrate(db))
+    {
+        esyslogs(source,"failed to migrate %s",g->EPGFile());
+        cEPGDatabase::Close(db);
+        xmlFreeDoc(xmltv);
+        return 141;
+    }
+
+    // tables created here already have the current layout
+    char *sql;
+    if (asprintf(&sql,"CREATE TABLE IF NOT EXISTS epg (" EPG_COLUMNS ");" \
+                 "CREATE TABLE IF NOT EXISTS watermarks (" \
+                 "src nvarchar(100), channelid nvarchar(255), modified int, applied int, appliedend int, " \
+                 "setup int, PRIMARY KEY(src, channelid)" \
+                 ");" \
+                 EPG_INDEXES \
+                 "PRAGMA user_version=%i;",cEPGDatabase::SchemaVersion())==-1)
+    {
+        esyslogs(source,"out of memory");
+        cEPGDatabase::Close(db);
+        xmlFreeDoc(xmltv);
+        return 134;
+    }
 
     char *errmsg;
-    if (sqlite3_exec(db,sql,NULL,NULL,&errmsg)!=SQLITE_OK)
+    int ret=sqlite3_exec(db,sql,NULL,NULL,&errmsg);
+    free(sql);
+    if (ret!=SQLITE_OK)
     {
         esyslogs(source,"createdb: %s",errmsg);
         sqlite3_free(errmsg);
-        sqlite3_close(db);
+        cEPGDatabase::Close(db);
+        xmlFreeDoc(xmltv);
+        return 141;
+    }
+    // full text index of a new database
+    cEPGDatabase::Migrate(db);
+
+    if (sqlite3_exec(db,"BEGIN",NULL,NULL,&errmsg)!=SQLITE_OK)
+    {
+        esyslogs(source,"sqlite3: BEGIN -> %s",errmsg);
+        sqlite3_free(errmsg);
+        cEPGDatabase::Close(db);
+        xmlFreeDoc(xmltv);
+        return 141;
+    }
+
+    sqlite3_stmt *istmt=NULL,*ustmt=NULL;
+    if ((sqlite3_prepare_v2(db,cXMLTVEvent::InsertSQL,-1,&istmt,NULL)!=SQLITE_OK) ||
+            (sqlite3_prepare_v2(db,cXMLTVEvent::UpdateSQL,-1,&ustmt,NULL)!=SQLITE_OK))
+    {
+        esyslogs(source,"sqlite3: %s",sqlite3_errmsg(db));
+        sqlite3_finalize(istmt);
+        cEPGDatabase::Close(db);
         xmlFreeDoc(xmltv);
         return 141;
     }
@@ -972,8 +1067,10 @@ int cParse::Process(cEPGExecutor &myExecutor,char *buffer, int bufsize)
 
     int lerr=0,lweak=0;
     xmlChar *lastchannelid=NULL;
-    int skipped=0;
-    bool do_unlink=false;
+    int skipped=0,processed=0;
+    std::set<std::string> changedchannels,pending;
+    int chunk=0;
+    bool failed=false;
     while (node)
     {
         if (node->type!=XML_ELEMENT_NODE)
@@ -1095,94 +1192,124 @@ int cParse::Process(cEPGExecutor &myExecutor,char *buffer, int bufsize)
 
         for (int i=0; i<map->NumChannelIDs(); i++)
         {
-            char *isql,*usql;
-            xevent.GetSQL(source->Name(),source->Index(),map->ChannelIDs()[i].ToString(),&isql,&usql);
-            if (isql && usql)
+            if (!xevent.Bind(istmt,source->Name(),source->Index(),*map->ChannelIDs()[i].ToString()))
+            {
+                esyslogs(source,"sqlite3: failed to bind (%u@%i)",xevent.EventID(),node->line);
+                skipped++;
+                break;
+            }
+            int ret=sqlite3_step(istmt);
+            bool changed=(ret==SQLITE_DONE);
+            sqlite3_reset(istmt);
+            bool update_issued=false;
+            if (ret==SQLITE_CONSTRAINT)
             {
-                int ret=sqlite3_exec(db,isql,NULL,NULL,&errmsg);
-                if (ret!=SQLITE_OK)
+                xevent.Bind(ustmt,source->Name(),source->Index(),*map->ChannelIDs()[i].ToString());
+                ret=sqlite3_step(ustmt);
+                sqlite3_reset(ustmt);
+                update_issued=true;
+                changed=((ret==SQLITE_DONE) && (sqlite3_changes(db)>0));
+            }
+            if (ret!=SQLITE_DONE)
+            {
+                if (lerr!=PARSE_SQLERR)
                 {
-                    bool update_issued=false;
-                    if (ret==SQLITE_CONSTRAINT)
+                    if (!xevent.WeakID())
                     {
-                        sqlite3_free(errmsg);
-                        ret=sqlite3_exec(db,usql,NULL,NULL,&errmsg);
-                        update_issued=true;
+                        esyslogs(source,"sqlite3: %s (%u@%i)",sqlite3_errmsg(db),xevent.EventID(),node->line);
                     }
-                    if (ret!=SQLITE_OK)
+                    else
                     {
-                        if (lerr!=PARSE_SQLERR)
-                        {
-                            if (strstr(errmsg,"has no column named"))
-                            {
-                                esyslogs(source,"sqlite3: database schema changed, unlinking epg.db!");
-                                do_unlink=true;
-                            }
-                            else
-                            {
-                                if (!xevent.WeakID())
-                                {
-                                    esyslogs(source,"sqlite3: %s (%u@%i)",errmsg,xevent.EventID(),node->line);
-                                    tsyslogs(source,"sqlite3: %s",isql);
-                                    if (update_issued) tsyslogs(source,"sqlite3: %s",usql);
-                                }
-                                else
-                                {
-                                    esyslogs(source,"sqlite3: %s ('%s'@%i)",errmsg,xevent.Title(),node->line);
-                                    tsyslogs(source,"sqlite3: %s",isql);
-                                    if (update_issued) tsyslogs(source,"sqlite3: %s",usql);
-                                }
-                            }
-                        }
-                        lerr=PARSE_SQLERR;
-                        sqlite3_free(errmsg);
-                        skipped++;
-                        break;
+                        esyslogs(source,"sqlite3: %s ('%s'@%i)",sqlite3_errmsg(db),xevent.Title(),node->line);
                     }
+                    tsyslogs(source,"sqlite3: %s",update_issued ? cXMLTVEvent::UpdateSQL : cXMLTVEvent::InsertSQL);
                 }
+                lerr=PARSE_SQLERR;
+                skipped++;
+                break;
+            }
+            if (changed)
+            {
+                changedchannels.insert(*map->ChannelIDs()[i].ToString());
+                pending.insert(*map->ChannelIDs()[i].ToString());
             }
+            processed++;
         }
         node=node->next;
+        if (++chunk>=PARSE_CHUNK)
+        {
+            // let the epg handler and housekeeping write between chunks
+            if (!Checkpoint(db,pending))
+            {
+                lerr=PARSE_SQLERR;
+                failed=true;
+                break;
+            }
+            chunk=0;
+        }
         if (!myExecutor.StillRunning())
         {
             isyslogs(source,"request to stop from vdr");
             break;
         }
-        if (do_unlink) break;
     }
+    sqlite3_finalize(istmt);
+    sqlite3_finalize(ustmt);
 
-    if (sqlite3_exec(db,"COMMIT",NULL,NULL,&errmsg)!=SQLITE_OK)
+    if (!failed && !RaiseWatermarks(db,pending))
+    {
+        sqlite3_exec(db,"ROLLBACK",NULL,NULL,NULL);
+        lerr=PARSE_SQLERR;
+        failed=true;
+    }
+    if (!failed && (sqlite3_exec(db,"COMMIT",NULL,NULL,&errmsg)!=SQLITE_OK))
     {
         esyslogs(source,"sqlite3: COMMIT %s",errmsg);
         sqlite3_free(errmsg);
     }
 
-    int cnt=sqlite3_total_changes(db);
+    for (std::set<std::string>::iterator it=changedchannels.begin(); it!=changedchannels.end(); ++it)
+    {
+        g->XMLTVCache()->Invalidate(it->c_str());
+    }
 
-    if ((skipped) && (!do_unlink))
+    if (skipped)
         isyslogs(source,"skipped %i xmltv events",skipped);
 
     if (!lerr)
     {
-        isyslogs(source,"processed %i xmltv events",cnt);
+        isyslogs(source,"processed %i xmltv events",processed);
     }
     else
     {
-        isyslogs(source,"processed %i xmltv events - see ERRORs above!",cnt);
+        isyslogs(source,"processed %i xmltv events - see ERRORs above!",processed);
+    }
+    dsyslogs(source,"%i channels changed",(int) changedchannels.size());
+
+    if (failed)
+    {
+        // the last chunk was rolled back, the next run parses the file again
+        esyslogs(source,"failed to raise watermarks, parse incomplete");
+        cEPGDatabase::Close(db);
+        if (created) g->DBChanged();
+        xmlFreeDoc(xmltv);
+        return 141;
     }
 
+    // the first import is stored uncompressed and used to train the dictionary
+    if (cXMLTVCompressor::Enabled()) cXMLTVCompressor::Train(db);
+
     if (sqlite3_exec(db,"ANALYZE epg;",NULL,NULL,&errmsg)!=SQLITE_OK)
     {
         esyslogs(source,"sqlite3: ANALYZE %s",errmsg);
         sqlite3_free(errmsg);
     }
 
-    sqlite3_close(db);
+    cEPGDatabase::Close(db);
+    // changed channels are invalidated above, only a new file needs more
+    if (created) g->DBChanged();
 
     xmlFreeDoc(xmltv);
-
-    if (do_unlink) unlink(g->EPGFile());
-
     return 0;
 }
 
@@ -11,6 +11,8 @@
 #include <vdr/epg.h>
 #include <libxml/parser.h>
 #include <time.h>
+#include <set>
+#include <string>
 
 #include "maps.h"
 #include "event.h"
@@ -41,6 +43,8 @@ private:
     cXMLTVEvent xevent;
     time_t ConvertXMLTVTime2UnixTime(char *xmltvtime);
     bool FetchEvent(xmlNodePtr node, bool useeptext);
+    bool RaiseWatermarks(sqlite3 *Db, std::set<std::string> &Channels);
+    bool Checkpoint(sqlite3 *Db, std::set<std::string> &Channels);
 public:
     cParse(cEPGSource *Source, cGlobals *Global);
     ~cParse();
@@ -532,6 +532,7 @@ void cMenuSetupXmltv2vdrTextMap::Store()
     savetval(season);
     savetval(episode);
     savetval(episodeoverall);
+    g->SetupChanged();
 
     SetupStore("textmap.country",country);
     SetupStore("textmap.year",year);
@@ -1322,6 +1323,7 @@ void cMenuSetupXmltv2vdrChannelMap::epgmappingreplace(cEPGMapping *newmapping)
     {
         map->ChangeFlags(newmapping->Flags());
         map->ReplaceChannels(newmapping->NumChannelIDs(),newmapping->ChannelIDs());
+        g->EPGMappings()->Rebuild();
     }
 }
 
@@ -96,18 +96,25 @@ void cEPGExecutor::Action()
     if (forceimportsrc>=0)
     {
         cEPGSource *epgs=sources->Get(forceimportsrc);
-        if (epgs) epgs->Import(*this);
+        if (epgs) epgs->Import(*this,NULL,true);
     }
     else
     {
+        cEPGSource *first=NULL;
+        int cnt=0;
         for (cEPGSource *epgs=sources->First(); epgs; epgs=sources->Next(epgs))
         {
             if (!epgs->LastRetCode())
             {
-                epgs->Import(*this);
-                break; // only import from the first successful source!
+                if (!first) first=epgs;
+                cnt++;
             }
         }
+        if (first)
+        {
+            // merge all successful sources in one pass, the first one wins
+            first->Import(*this,(cnt>1) ? sources : NULL,forcedownload);
+        }
     }
     forceimportsrc=-1;
     forcedownload=false;
@@ -457,9 +464,9 @@ int cEPGSource::ReadOutput(char *&result, size_t &l)
     return ret;
 }
 
-int cEPGSource::Import(cEPGExecutor &myExecutor)
+int cEPGSource::Import(cEPGExecutor &myExecutor, cEPGSources *Merge, bool Full)
 {
-    return import->Process(this,myExecutor);
+    return import->Process(this,myExecutor,Merge,Full);
 }
 
 int cEPGSource::Execute(cEPGExecutor &myExecutor)
@@ -885,7 +892,7 @@ bool cEPGSources::MoveEPGSource(cGlobals *Global, int From, int To)
     if (From==To) return false;
 
     sqlite3 *db=NULL;
-    if (sqlite3_open_v2(Global->EPGFile(),&db,SQLITE_OPEN_READWRITE,NULL)==SQLITE_OK)
+    if ((db=cEPGDatabase::Open(Global->EPGFile())))
     {
         char *sql=NULL;
         if (asprintf(&sql,"BEGIN TRANSACTION;" \
@@ -894,13 +901,13 @@ bool cEPGSources::MoveEPGSource(cGlobals *Global, int From, int To)
                      "UPDATE epg SET srcidx=%i WHERE srcidx=98;" \
                      "COMMIT;", To, From, To, From)==-1)
         {
-            sqlite3_close(db);
+            cEPGDatabase::Close(db);
             return false;
         }
         if (sqlite3_exec(db,sql,NULL,NULL,NULL)!=SQLITE_OK)
         {
             free(sql);
-            sqlite3_close(db);
+            cEPGDatabase::Close(db);
             return false;
         }
         free(sql);
@@ -909,8 +916,9 @@ bool cEPGSources::MoveEPGSource(cGlobals *Global, int From, int To)
     {
         return false;
     }
-    sqlite3_close(db);
+    cEPGDatabase::Close(db);
     Global->EPGSources()->Move(From,To);
+    Global->XMLTVCache()->Clear();
     return true;
 }
 
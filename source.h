@@ -46,6 +46,7 @@ class cEPGChannels : public cList<cEPGChannel> {};
 
 class cImport;
 class cGlobals;
+class cEPGSources;
 
 class cEPGSource : public cListObject
 {
@@ -80,7 +81,7 @@ public:
         return (logfile!=NULL);
     }
     int Execute(cEPGExecutor &myExecutor);
-    int Import(cEPGExecutor &myExecutor);
+    int Import(cEPGExecutor &myExecutor, cEPGSources *Merge=NULL, bool Full=false);
     bool RunItNow(bool ForceDownload=false);
     time_t NextRunTime(time_t Now=(time_t) 0);
     void Store(void);
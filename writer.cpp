@@ -0,0 +1,174 @@
+/*
+ * writer.cpp: A plugin for the Video Disk Recorder
+ *
+ * See the README file for copyright information and how to reach the author.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "writer.h"
+#include "xmltv2vdr.h"
+#include "debug.h"
+
+cXMLTVWriter::cXMLTVWriter(cGlobals *Global) : cThread("xmltv2vdr writer"),import(Global)
+{
+    g=Global;
+    head=0;
+    count=0;
+    dropped=0;
+    SetPriority(19);
+}
+
+cXMLTVWriter::~cXMLTVWriter()
+{
+    Stop();
+    for (int i=0; i<count; i++) freejob(queue[(head+i) % QUEUESIZE]);
+    count=0;
+}
+
+void cXMLTVWriter::freejob(job *Job)
+{
+    if (!Job) return;
+    free(Job->source);
+    free(Job->channelid);
+    free(Job->description);
+    delete Job->xevent;
+    delete Job;
+}
+
+bool cXMLTVWriter::push(job *Job)
+{
+    cMutexLock lock(&mutex);
+    if (count==QUEUESIZE)
+    {
+        // never block the caller, the event will be seen again
+        if (!dropped++) dsyslog("writer queue full, dropping database updates");
+        freejob(Job);
+        return false;
+    }
+    queue[(head+count) % QUEUESIZE]=Job;
+    count++;
+    cond.Broadcast();
+    return true;
+}
+
+bool cXMLTVWriter::Insert(const char *Source, const char *ChannelID, cXMLTVEvent *xEvent)
+{
+    if (!Source || !ChannelID || !xEvent)
+    {
+        delete xEvent;
+        return false;
+    }
+    job *j=new job;
+    memset(j,0,sizeof(job));
+    j->type=JOB_INSERT;
+    j->source=strdup(Source);
+    j->channelid=strdup(ChannelID);
+    j->xevent=xEvent;
+    return push(j);
+}
+
+bool cXMLTVWriter::UpdateEIT(const char *Source, const char *ChannelID, tEventID EITEventID, tEventID EventID,
+                             const char *Description, sqlite3_int64 RowID, bool NewEITEventID)
+{
+    if (!Source || !ChannelID) return false;
+    job *j=new job;
+    memset(j,0,sizeof(job));
+    j->type=JOB_UPDATEEIT;
+    j->source=strdup(Source);
+    j->channelid=strdup(ChannelID);
+    j->eiteventid=EITEventID;
+    j->eventid=EventID;
+    j->description=Description ? strdup(Description) : NULL;
+    j->rowid=RowID;
+    j->neweiteventid=NewEITEventID;
+    return push(j);
+}
+
+void cXMLTVWriter::write(sqlite3 **Db, job **Jobs, int Count)
+{
+    if (!*Db)
+    {
+        if (!(*Db=cEPGDatabase::Open(g->EPGFile())))
+        {
+            esyslog("failed to open %s",g->EPGFile());
+        }
+    }
+
+    for (int i=0; i<Count; i++)
+    {
+        job *j=Jobs[i];
+        cEPGSource *source=g->EPGSources()->GetSource(j->source);
+        if (*Db && source)
+        {
+            switch (j->type)
+            {
+            case JOB_INSERT:
+                import.InsertXMLTVEvent(source,*Db,j->channelid,j->xevent);
+                break;
+            case JOB_UPDATEEIT:
+                import.UpdateEITEvent(source,*Db,j->channelid,j->eiteventid,j->eventid,
+                                      j->description,j->rowid,j->neweiteventid);
+                break;
+            }
+        }
+    }
+    if (!*Db || !import.Commit(NULL,*Db))
+    {
+        // the batch is rolled back, forget the rowids it added to the cache
+        esyslog("writer lost %i database updates",Count);
+        for (int i=0; i<Count; i++)
+        {
+            if (Jobs[i]->type==JOB_INSERT) g->XMLTVCache()->Invalidate(Jobs[i]->channelid);
+        }
+    }
+    for (int i=0; i<Count; i++) freejob(Jobs[i]);
+}
+
+void cXMLTVWriter::Stop()
+{
+    mutex.Lock();
+    cond.Broadcast();
+    mutex.Unlock();
+    Cancel(10);
+}
+
+void cXMLTVWriter::Action()
+{
+    sqlite3 *db=NULL;
+    job *batch[BATCHSIZE];
+    for (;;)
+    {
+        bool running=Running();
+        mutex.Lock();
+        if (!count && running) cond.TimedWait(mutex,1000);
+        int n=0;
+        while (count && (n<BATCHSIZE))
+        {
+            batch[n++]=queue[head];
+            head=(head+1) % QUEUESIZE;
+            count--;
+        }
+        if (dropped)
+        {
+            isyslog("writer dropped %i database updates",dropped);
+            dropped=0;
+        }
+        mutex.Unlock();
+
+        if (n)
+        {
+            write(&db,batch,n);
+            continue;
+        }
+        // idle, release the database
+        if (db)
+        {
+            import.Close(db);
+            db=NULL;
+        }
+        if (!running) break;
+    }
+}
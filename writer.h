@@ -0,0 +1,68 @@
+/*
+ * writer.h: A plugin for the Video Disk Recorder
+ *
+ * See the README file for copyright information and how to reach the author.
+ *
+ */
+
+#ifndef _WRITER_H
+#define _WRITER_H
+
+#include <sqlite3.h>
+#include <vdr/thread.h>
+#include <vdr/epg.h>
+
+#include "import.h"
+
+class cGlobals;
+class cXMLTVEvent;
+
+// queues the database writes of the epg handler, so the
+// eit thread never waits for sqlite
+class cXMLTVWriter : public cThread
+{
+private:
+    enum
+    {
+        QUEUESIZE=2048,
+        BATCHSIZE=256
+    };
+    enum
+    {
+        JOB_INSERT=1,
+        JOB_UPDATEEIT
+    };
+    struct job
+    {
+        int type;
+        char *source;
+        char *channelid;
+        cXMLTVEvent *xevent;
+        tEventID eiteventid;
+        tEventID eventid;
+        char *description;
+        sqlite3_int64 rowid;
+        bool neweiteventid;
+    };
+    job *queue[QUEUESIZE];
+    int head;
+    int count;
+    int dropped;
+    cMutex mutex;
+    cCondVar cond;
+    cGlobals *g;
+    cImport import;
+    bool push(job *Job);
+    void freejob(job *Job);
+    void write(sqlite3 **Db, job **Jobs, int Count);
+public:
+    cXMLTVWriter(cGlobals *Global);
+    ~cXMLTVWriter();
+    bool Insert(const char *Source, const char *ChannelID, cXMLTVEvent *xEvent);
+    bool UpdateEIT(const char *Source, const char *ChannelID, tEventID EITEventID, tEventID EventID,
+                   const char *Description, sqlite3_int64 RowID, bool NewEITEventID);
+    void Stop();
+    virtual void Action();
+};
+
+#endif
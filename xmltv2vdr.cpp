@@ -19,6 +19,7 @@
 #include <netdb.h>
 #include <libgen.h>
 #include <sys/vfs.h>
+#include <sys/inotify.h>
 
 #include "setup.h"
 #include "xmltv2vdr.h"
@@ -274,8 +275,15 @@ cGlobals::cGlobals()
     epghandler=NULL;
     epgtimer=NULL;
     epgseasonepisode=NULL;
+    xmltvwriter=NULL;
+    dbgeneration=0;
+    dbexists=false;
+    dbwatch=-1;
+    dbwatchname=NULL;
+    dbid=0;
     epall=0;
     order=strdup(GetDefaultOrder());
+    setupgeneration=0;
     imgdelafter=30;
     soundex=false;
 
@@ -372,6 +380,8 @@ cGlobals::~cGlobals()
     free(codeset);
     free(order);
     free(srcorder);
+    free(dbwatchname);
+    if (dbwatch!=-1) close(dbwatch);
     if (epgtimer)
     {
         epgtimer->Stop();
@@ -382,6 +392,11 @@ cGlobals::~cGlobals()
         epgseasonepisode->Stop();
         delete epgseasonepisode;
     }
+    if (xmltvwriter)
+    {
+        xmltvwriter->Stop();
+        delete xmltvwriter;
+    }
     epgsources.Remove();
     epgmappings.Remove();
     textmappings.Remove();
@@ -447,87 +462,6 @@ void cGlobals::SetEPGFile(const char *EPGFile)
 }
 
 
-void cGlobals::CopyEPGFile(bool Init)
-{
-    if ((!epgfile) || (!epgfile_store)) return;
-    if (!strcmp(epgfile,epgfile_store)) return; // same dir
-
-    struct stat statbuf;
-    char *tmpdstfile=NULL;
-    int fd=-1;
-
-    if (Init)
-    {
-        if (stat(epgfile_store,&statbuf)==-1) return; // no file?
-        fd=open(epgfile_store,O_RDONLY);
-    }
-    else
-    {
-        if (stat(epgfile,&statbuf)==-1) return;
-        fd=open(epgfile,O_RDONLY);
-    }
-
-    if (fd==-1) return; // no file??
-    char *buf=(char *) malloc(statbuf.st_size+1);
-    if (!buf)
-    {
-        close(fd);
-        return;
-    }
-    if (read(fd,buf,statbuf.st_size)!=statbuf.st_size)
-    {
-        free(buf);
-        close(fd);
-        return;
-    }
-    close(fd);
-    if (Init)
-    {
-        fd=creat(epgfile,0644);
-    }
-    else
-    {
-        if (asprintf(&tmpdstfile,"%s_",epgfile_store)==-1)
-        {
-            free(buf);
-            return;
-        }
-        fd=creat(tmpdstfile,0644);
-    }
-    if (fd==-1)
-    {
-        if (!Init) free(tmpdstfile);
-        free(buf);
-        return;
-    }
-    if (write(fd,buf,statbuf.st_size)!=statbuf.st_size)
-    {
-        close(fd);
-        if (Init)
-        {
-            unlink(epgfile);
-        }
-        else
-        {
-            unlink(tmpdstfile);
-            free(tmpdstfile);
-        }
-        free(buf);
-        return;
-    }
-    close(fd);
-    free(buf);
-    if (!Init)
-    {
-        if (rename(tmpdstfile,epgfile_store)!=-1)
-        {
-            unlink(epgfile);
-        }
-        free(tmpdstfile);
-    }
-}
-
-
 char *cGlobals::GetDefaultOrder()
 {
     return (char *) "LOT,CRS,CAD,ORT,CAT,VID,AUD,SEE,RAT,STR,REV";
@@ -578,6 +512,63 @@ bool cGlobals::DBExists()
     return true;
 }
 
+void cGlobals::DBChanged()
+{
+    // rowids of a replaced database are meaningless
+    dbexists=DBExists();
+    dbid=DBIdentity();
+    xmltvcache.Clear();
+    dbgeneration++;
+}
+
+uint64_t cGlobals::DBIdentity()
+{
+    if (!epgfile) return 0;
+    struct stat statbuf;
+    if (stat(epgfile,&statbuf)==-1) return 0;
+    return HashInt(statbuf.st_ino,HashInt(statbuf.st_dev));
+}
+
+void cGlobals::WatchDB()
+{
+    // safety net for changes we are not told about
+    if (!epgfile) return;
+    if (dbwatch==-1) dbwatch=inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if (dbwatch==-1)
+    {
+        esyslog("failed to watch %s",epgfile);
+        return;
+    }
+    char *tmp=strdup(epgfile);
+    if (!tmp) return;
+    free(dbwatchname);
+    dbwatchname=strdup(basename(tmp));
+    strcpy(tmp,epgfile);
+    // only replacements, our own connections close the file all the time
+    if (inotify_add_watch(dbwatch,dirname(tmp),IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO)==-1)
+    {
+        esyslog("failed to watch %s",epgfile);
+    }
+    free(tmp);
+}
+
+void cGlobals::CheckDBWatch()
+{
+    if ((dbwatch==-1) || !dbwatchname) return;
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    bool changed=false;
+    ssize_t len;
+    while ((len=read(dbwatch,buf,sizeof(buf)))>0)
+    {
+        for (char *p=buf; p<buf+len; p+=sizeof(struct inotify_event)+((struct inotify_event *) p)->len)
+        {
+            struct inotify_event *event=(struct inotify_event *) p;
+            if (event->len && !strcmp(event->name,dbwatchname)) changed=true;
+        }
+    }
+    if (changed && (DBIdentity()!=dbid)) DBChanged();
+}
+
 // -------------------------------------------------------------
 
 cEPGHandler::cEPGHandler(cGlobals* Global): import(Global)
@@ -585,8 +576,14 @@ cEPGHandler::cEPGHandler(cGlobals* Global): import(Global)
     epall=0;
     maps=Global->EPGMappings();
     sources=Global->EPGSources();
+    cache=Global->XMLTVCache();
+    global=Global;
     db=NULL;
     now=0;
+    memogeneration=0;
+    dbgeneration=Global->DBGeneration();
+    lastprune=0;
+    import.SetWriter(Global->XMLTVWriter());
     if (ioprio_set(1,getpid(),7 | 3 << 13)==-1)
     {
         tsyslog("failed to set ioprio to 3,7");
@@ -607,7 +604,7 @@ bool cEPGHandler::check4proc(cEvent *event, cEPGMapping **map)
     if (!event) return false;
     if (now>(event->StartTime()+event->Duration())) return false; // event in the past?
     if (!maps) return false;
-    if (!import.DBExists()) return false;
+    if (!global->DBAvailable()) return false;
 
     cEPGMapping *t_map=maps->GetMap(event->ChannelID());
     if (!t_map)
@@ -619,6 +616,46 @@ bool cEPGHandler::check4proc(cEvent *event, cEPGMapping **map)
     return true;
 }
 
+cEPGHandler::memo *cEPGHandler::getmemo(const cEvent *Event)
+{
+    // new xmltv data, another database or a changed setup invalidates everything
+    uint64_t generation=HashInt(cache->Generation(),HashInt(global->SetupGeneration(),HashInt(epall)));
+    generation=HashInt(global->DBGeneration(),generation);
+    if (generation!=memogeneration)
+    {
+        memos.clear();
+        memogeneration=generation;
+    }
+    if (now-lastprune>600)
+    {
+        for (std::map<uint64_t,memo>::iterator it=memos.begin(); it!=memos.end();)
+        {
+            if (it->second.end<now)
+            {
+                memos.erase(it++);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        lastprune=now;
+    }
+
+    uint64_t key=HashInt(Event->EventID(),HashStr(*Event->ChannelID().ToString()));
+    memo &m=memos[key];
+    m.end=Event->StartTime()+Event->Duration();
+    return &m;
+}
+
+uint64_t cEPGHandler::eventstate(const cEvent *Event, const char *Description)
+{
+    uint64_t hash=HashInt(Event->TableID());
+    hash=HashInt(Event->Version(),hash);
+    hash=HashInt(Event->HasTimer(),hash);
+    return HashStr(Description,hash);
+}
+
 bool cEPGHandler::SetShortText(cEvent* Event, const char* ShortText)
 {
     // prevent setting empty shorttext
@@ -642,6 +679,18 @@ bool cEPGHandler::SetDescription(cEvent* Event, const char* Description)
 {
     if (!check4proc(Event,NULL)) return false;
 
+    // same table, version, old and new text as last time -> same answer,
+    // setdescription() compares with the current description
+    memo *m=getmemo(Event);
+    uint64_t state=HashStr(Event->Description(),eventstate(Event,Description));
+    if (m->description==state) return m->descresult;
+    m->description=state;
+    m->descresult=setdescription(Event,Description);
+    return m->descresult;
+}
+
+bool cEPGHandler::setdescription(cEvent* Event, const char* Description)
+{
     if (import.WasChanged(Event))
     {
         // ok we already changed this event!
@@ -672,6 +721,16 @@ bool cEPGHandler::HandleEvent(cEvent* Event)
     cEPGMapping *map;
     if (!check4proc(Event,&map)) return false;
 
+    // nothing changed since we handled this event
+    memo *m=getmemo(Event);
+    if (m->handled==eventstate(Event,Event->Description())) return false;
+    if (handleevent(Event,map)) m->handled=eventstate(Event,Event->Description());
+    return false; // let other handlers change this event
+}
+
+bool cEPGHandler::handleevent(cEvent* Event, cEPGMapping *map)
+{
+
     int Flags=0;
     const char *ChannelID=strdup(*Event->ChannelID().ToString());
     if (!ChannelID) return false;
@@ -682,23 +741,42 @@ bool cEPGHandler::HandleEvent(cEvent* Event)
     }
     else
     {
-	if (!map) return false;
+	if (!map) return true;
         Flags=map->Flags();
     }
 
+    if (cache->KnownMiss(ChannelID,Event))
+    {
+        free((void*)ChannelID);
+        return true;
+    }
+
+    if (dbgeneration!=global->DBGeneration())
+    {
+        // epg.db has been replaced, don't read from the old file
+        if (db)
+        {
+            import.Commit(NULL,db);
+            import.Close(db);
+            db=NULL;
+        }
+        dbgeneration=global->DBGeneration();
+    }
+
     cEPGSource *source=NULL;
     cXMLTVEvent *xevent=import.SearchXMLTVEvent(&db,ChannelID,Event);
     if (!xevent)
     {
         if (!epall)
         {
+            if (db) cache->AddMiss(ChannelID,Event);
             free((void*)ChannelID);
-            return false;
+            return true;
         }
         if (db && sqlite3_errcode(db)!=SQLITE_OK)
         {
             free((void*)ChannelID);
-            return false;
+            return false; // try again next time
         }
 
         source=sources->GetSource(EITSOURCE);
@@ -709,8 +787,9 @@ bool cEPGHandler::HandleEvent(cEvent* Event)
         xevent=import.AddXMLTVEvent(source,db,ChannelID,Event,Event->Description(),useeptext);
         if (!xevent)
         {
+            cache->AddMiss(ChannelID,Event); // no season/episode found
             free((void*)ChannelID);
-            return false;
+            return true;
         }
         else
         {
@@ -726,7 +805,7 @@ bool cEPGHandler::HandleEvent(cEvent* Event)
     {
         tsyslog("no source for %s",xevent->Source());
         delete xevent;
-        return false;
+        return true;
     }
 
     if (xevent->Title() && Event->Title())
@@ -757,24 +836,30 @@ bool cEPGHandler::HandleEvent(cEvent* Event)
                 import.UpdateXMLTVEvent(source,db,Event,xevent,NULL);
                 Event->SetEventID(oldID);
                 delete xevent;
-                return false;
+                return true;
             }
         }
     }
 
     import.PutEvent(source,db,NULL,Event,xevent,Flags);
     delete xevent;
-    return false; // let other handlers change this event
+    return true;
 }
 
-bool cEPGHandler::SortSchedule(cSchedule* UNUSED(Schedule))
+cEPGHandler::~cEPGHandler()
 {
     if (db)
     {
         import.Commit(NULL,db);
-        sqlite3_close(db);
-        db=NULL;
+        import.Close(db);
     }
+}
+
+bool cEPGHandler::SortSchedule(cSchedule* UNUSED(Schedule))
+{
+    // the connection stays open for the next schedule, it is
+    // only dropped when epg.db is replaced (see handleevent)
+    if (db) import.Commit(NULL,db);
     return false; // we dont sort!
 }
 
@@ -786,6 +871,10 @@ cEPGTimer::cEPGTimer(cGlobals *Global) :
     sources=Global->EPGSources();
     maps=Global->EPGMappings();
     epall=0;
+    force=false;
+#if VDRVERSNUM<20301
+    timersstate=0;
+#endif
     SetPriority(19);
     if (ioprio_set(1,getpid(),7 | 3 << 13)==-1)
     {
@@ -793,6 +882,18 @@ cEPGTimer::cEPGTimer(cGlobals *Global) :
     }
 }
 
+bool cEPGTimer::TimersChanged()
+{
+    // called from the main thread, cheap if nothing changed
+#if VDRVERSNUM>=20301
+    if (!cTimers::GetTimersRead(timerskey,10)) return false;
+    timerskey.Remove();
+    return true;
+#else
+    return Timers.Modified(timersstate);
+#endif
+}
+
 void cEPGTimer::Action()
 {
     if (!import.DBExists()) return; // no database? -> exit immediately
@@ -806,11 +907,17 @@ void cEPGTimer::Action()
     Timers.IncBeingEdited();
 #endif
 
+    // taken once, a ForceAll() during this run applies to the next one
+    bool forced=force.exchange(false);
     sqlite3 *db=NULL;
     cEPGSource *source=sources->GetSource(EITSOURCE);
     bool useeptext=((epall & EPLIST_USE_STEXTITLE)==EPLIST_USE_STEXTITLE);
     int Flags=USE_SEASON;
     if (useeptext) Flags|=(USE_SHORTTEXT|OPT_SEASON_STEXTITLE);
+    std::vector<uint64_t> keys,hashes,done;
+    std::vector<cEvent *> events;
+    std::vector<const char *> channelids;
+    std::vector<cString> descrs;
 
 #if VDRVERSNUM<20301
     for (cTimer *Timer = Timers.First(); Timer; Timer = Timers.Next(Timer))
@@ -824,6 +931,19 @@ void cEPGTimer::Action()
         if (Timer->Recording()) continue; // to late ;)
         cEvent *event=(cEvent *) Timer->Event();
         if (!event) continue;
+
+        // only added, edited or rebound timers
+#if VDRVERSNUM>=20301
+        uint64_t key=Timer->Id();
+#else
+        uint64_t key=(uint64_t) (uintptr_t) Timer;
+#endif
+        uint64_t timerhash=HashStr(*Timer->ToText(true));
+        enrichment &e=enriched[key];
+        e.seen=true;
+        if (!forced && (e.timer==timerhash) && (e.eventid==event->EventID()) &&
+                (e.starttime==event->StartTime())) continue;
+
         if (!useeptext)
         {
             if (!event->ShortText() && !event->Description()) continue; // no text -> no episode
@@ -837,44 +957,86 @@ void cEPGTimer::Action()
             if (event->ShortText()) continue; // already processed by xmltv2vdr
         }
 
-        const char *ChannelID=strdup(*event->ChannelID().ToString());
-        cXMLTVEvent *xevent=import.SearchXMLTVEvent(&db,ChannelID,event);
-        if (!xevent)
-        {
-            xevent=import.AddXMLTVEvent(source,db,ChannelID,event,event->Description(),useeptext);
-            if (!xevent)
-            {
-                free((void*)ChannelID);
-                continue;
-            }
-            else
-            {
-                tsyslog("{%5i} +adding '%s'/'%s' (%s)",event->EventID(),xevent->Title(),xevent->ShortText(),*Timer->ToDescr());
-            }
-        }
-        else
+        keys.push_back(key);
+        hashes.push_back(timerhash);
+        events.push_back(event);
+        channelids.push_back(strdup(*event->ChannelID().ToString()));
+        descrs.push_back(Timer->ToDescr());
+    }
+
+    // one joined query for all timers, misses are added in the same transaction
+    int count=(int) events.size();
+    if (count)
+    {
+        std::vector<cXMLTVEvent *> xevents(count,(cXMLTVEvent *) NULL);
+        int found=import.SearchXMLTVEvents(source,&db,count,&channelids[0],
+                                           (const cEvent *const *) &events[0],&xevents[0]);
+        if (found>=0)
         {
-            if (!event->ShortText() && event->Description())
+            tsyslog("found %i of %i timer events",found,count);
+            for (int i=0; i<count; i++)
             {
-                if (import.AddShortTextFromEITDescription(xevent,event->Description()))
+                cEvent *event=events[i];
+                cXMLTVEvent *xevent=xevents[i];
+                if (!xevent)
                 {
-                    import.UpdateXMLTVEvent(source,db,xevent);
+                    xevent=import.AddXMLTVEvent(source,db,channelids[i],event,event->Description(),useeptext);
+                    if (!xevent) continue;
+                    tsyslog("{%5i} +adding '%s'/'%s' (%s)",event->EventID(),xevent->Title(),xevent->ShortText(),
+                            *descrs[i]);
                 }
+                else
+                {
+                    if (!event->ShortText() && event->Description())
+                    {
+                        import.LoadXMLTVEvent(db,xevent);
+                        if (import.AddShortTextFromEITDescription(xevent,event->Description()))
+                        {
+                            import.UpdateXMLTVEvent(source,db,xevent);
+                        }
+                    }
+                }
+                bool applied=false;
+                import.PutEvent(source,db,NULL,event,xevent,Flags,&applied);
+                delete xevent;
+                if (!applied) continue;
+
+                // only enriched timers are skipped next time
+                enrichment &e=enriched[keys[i]];
+                e.timer=hashes[i];
+                e.eventid=event->EventID();
+                e.starttime=event->StartTime();
+                done.push_back(keys[i]);
             }
         }
-        free((void*)ChannelID);
-
-        import.PutEvent(source,db,NULL,event,xevent,Flags);
-        delete xevent;
+        for (int i=0; i<count; i++) free((void *) channelids[i]);
     }
 #if VDRVERSNUM>=20301
     StateKey.Remove();
 }
 #endif
+    // forget deleted timers
+    for (std::map<uint64_t,enrichment>::iterator it=enriched.begin(); it!=enriched.end();)
+    {
+        if (!it->second.seen)
+        {
+            enriched.erase(it++);
+        }
+        else
+        {
+            it->second.seen=false;
+            ++it;
+        }
+    }
+
 if (db)
 {
-    import.Commit(source,db);
-    sqlite3_close(db);
+    if (!import.Commit(source,db))
+    {
+        // retry these timers on the next run
+        for (size_t i=0; i<done.size(); i++) enriched.erase(done[i]);
+    }
+    import.Close(db);
 }
 
 #if VDRVERSNUM<20301
@@ -975,31 +1137,204 @@ void cHouseKeeping::Action()
     if (!schedules) return;
 #endif
 
-    sqlite3 *db=NULL;
-    if (sqlite3_open_v2(global->EPGFile(),&db,SQLITE_OPEN_READWRITE,NULL)==SQLITE_OK)
+    sqlite3 *db=cEPGDatabase::Open(global->EPGFile());
+    if (!db) return;
+
+    // old databases need one full VACUUM to enable incremental vacuum
+    if (cEPGDatabase::AutoVacuum(db)!=2)
     {
-        char *sql;
-        if (asprintf(&sql,"delete from epg where ((starttime+duration) < %li)",time(NULL))!=-1)
+        isyslog("enabling incremental vacuum on epg.db");
+        char *errmsg;
+        if (sqlite3_exec(db,"PRAGMA auto_vacuum=INCREMENTAL; VACUUM;",NULL,NULL,&errmsg)!=SQLITE_OK)
         {
-            char *errmsg;
-            if (sqlite3_exec(db,sql,NULL,NULL,&errmsg)!=SQLITE_OK)
-            {
-                esyslog("%s",errmsg);
-                sqlite3_free(errmsg);
-            }
-            else
+            esyslog("sqlite3: VACUUM -> %s",errmsg);
+            sqlite3_free(errmsg);
+        }
+        else if (cEPGDatabase::AutoVacuum(db)!=2)
+        {
+            esyslog("failed to enable incremental vacuum on epg.db");
+        }
+    }
+
+    // expiry is a row delete on idx6, there are no day partitions: the rowids
+    // cached by cXMLTVCache, UNIQUE(eventid, src, channelid) and the full text
+    // index all need a single epg table.
+    // small batches keep the write lock short, so the epg handler is not stalled
+    sqlite3_stmt *stmt=NULL;
+    if (sqlite3_prepare_v2(db,"delete from epg where rowid in (select rowid from epg where endtime < ?1 " \
+                           "limit 500);",-1,&stmt,NULL)!=SQLITE_OK)
+    {
+        esyslog("sqlite3: %s",sqlite3_errmsg(db));
+        cEPGDatabase::Close(db);
+        return;
+    }
+    sqlite3_bind_int64(stmt,1,time(NULL));
+    int changes=0;
+    while (Running())
+    {
+        int ret=sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if (ret!=SQLITE_DONE)
+        {
+            esyslog("sqlite3: %s",sqlite3_errmsg(db));
+            break;
+        }
+        if (!sqlite3_changes(db)) break;
+        changes+=sqlite3_changes(db);
+        cCondWait::SleepMs(10);
+    }
+    sqlite3_finalize(stmt);
+
+    if (changes)
+    {
+        isyslog("removed %i old entries from db",changes);
+        // give free pages back in bounded steps
+        while (Running() && (cEPGDatabase::FreePages(db)>0))
+        {
+            if (sqlite3_exec(db,"PRAGMA incremental_vacuum(64);",NULL,NULL,NULL)!=SQLITE_OK) break;
+            cCondWait::SleepMs(10);
+        }
+    }
+    // expired rows are never looked up again, the cache keeps its entries
+    cEPGDatabase::Close(db);
+}
+
+// -------------------------------------------------------------
+
+cEPGSnapshot::cEPGSnapshot(cGlobals *Global): cThread("xmltv2vdr snapshot")
+{
+    global=Global;
+    last=0;
+}
+
+bool cEPGSnapshot::Enabled()
+{
+    if (!global->EPGFile() || !global->EPGFileStore()) return false;
+    return (strcmp(global->EPGFile(),global->EPGFileStore())!=0); // same dir
+}
+
+bool cEPGSnapshot::Dirty()
+{
+    if (!Enabled()) return false;
+    struct stat statbuf;
+    if ((stat(global->EPGFile(),&statbuf)!=-1) && (statbuf.st_mtime>=last)) return true;
+    char *wal;
+    if (asprintf(&wal,"%s-wal",global->EPGFile())==-1) return true;
+    bool ret=((stat(wal,&statbuf)!=-1) && (statbuf.st_mtime>=last));
+    free(wal);
+    return ret;
+}
+
+void cEPGSnapshot::Restore()
+{
+    // called on start, before any other thread opens the database
+    if (!Enabled()) return;
+    if (access(global->EPGFileStore(),R_OK)==-1) return; // no file?
+    time_t now=time(NULL);
+    if (copy(global->EPGFileStore(),global->EPGFile(),true))
+    {
+        isyslog("restored %s",global->EPGFile());
+        last=now;
+    }
+}
+
+void cEPGSnapshot::Save(bool Wait)
+{
+    if (!Enabled()) return;
+    if (!Wait)
+    {
+        if (Active()) return;
+        Start();
+        return;
+    }
+    // called on shutdown, when all other threads are already stopped
+    Cancel(3);
+    time_t now=time(NULL);
+    if (last && (now-last<RECENT))
+    {
+        // changes since then get lost, the next parse brings them back
+        dsyslog("last snapshot is %li seconds old, not stored again",(long) (now-last));
+        return;
+    }
+    if (copy(global->EPGFile(),global->EPGFileStore(),true)) last=now;
+}
+
+bool cEPGSnapshot::copy(const char *From, const char *To, bool Wait)
+{
+    char *tmp;
+    if (asprintf(&tmp,"%s_",To)==-1) return false;
+    unlink(tmp);
+
+    sqlite3 *src=NULL,*dst=NULL;
+    if (sqlite3_open_v2(From,&src,SQLITE_OPEN_READONLY,NULL)!=SQLITE_OK)
+    {
+        esyslog("failed to open %s",From);
+        cEPGDatabase::Close(src);
+        free(tmp);
+        return false;
+    }
+    sqlite3_busy_timeout(src,5000);
+    if (sqlite3_open_v2(tmp,&dst,SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE,NULL)!=SQLITE_OK)
+    {
+        esyslog("failed to create %s",tmp);
+        cEPGDatabase::Close(dst);
+        cEPGDatabase::Close(src);
+        free(tmp);
+        return false;
+    }
+
+    bool ok=false;
+    sqlite3_backup *backup=sqlite3_backup_init(dst,"main",src,"main");
+    if (backup)
+    {
+        // other connections writing to the source restart the backup, after
+        // some restarts copy the rest in one step, a WAL reader blocks nobody.
+        // Synchronous copies run without other writers -> one step, no pauses
+        int ret,restarts=0,remaining=-1,pages=Wait ? -1 : PAGES;
+        for (;;)
+        {
+            ret=sqlite3_backup_step(backup,pages);
+            if ((ret==SQLITE_DONE) || ((ret!=SQLITE_OK) && (ret!=SQLITE_BUSY) && (ret!=SQLITE_LOCKED))) break;
+            if (!Wait && !Running()) break;
+            if ((remaining>=0) && (sqlite3_backup_remaining(backup)>remaining))
             {
-                int changes=sqlite3_changes(db);
-                if (changes)
-                {
-                    isyslog("removed %i old entries from db",changes);
-                    sqlite3_exec(db,"VACUUM;",NULL,NULL,NULL);
-                }
+                if (++restarts>=MAXRESTARTS) pages=-1;
             }
-            free(sql);
+            remaining=sqlite3_backup_remaining(backup);
+            cCondWait::SleepMs(5);
+        }
+        ok=(ret==SQLITE_DONE);
+        sqlite3_backup_finish(backup);
+    }
+    if (!ok) esyslog("sqlite3: %s (backup)",sqlite3_errmsg(dst));
+    cEPGDatabase::Close(dst);
+    cEPGDatabase::Close(src);
+
+    if (ok)
+    {
+        // rename replaces the file atomically, open connections keep the old one.
+        // Nobody has the target open here: the restore runs before the other
+        // threads start and the stored copy is only read by the restore.
+        cEPGDatabase::UnlinkWAL(To);
+        if (rename(tmp,To)==-1)
+        {
+            esyslog("failed to rename %s",tmp);
+            ok=false;
         }
     }
-    sqlite3_close(db);
+    if (!ok) unlink(tmp);
+    free(tmp);
+    return ok;
+}
+
+void cEPGSnapshot::Action()
+{
+    time_t now=time(NULL);
+    if (copy(global->EPGFile(),global->EPGFileStore(),false))
+    {
+        dsyslog("stored %s",global->EPGFileStore());
+        last=now;
+    }
 }
 
 // -------------------------------------------------------------
@@ -1016,14 +1351,14 @@ void cEPGSeasonEpisode::Action()
 
 // -------------------------------------------------------------
 
-cPluginXmltv2vdr::cPluginXmltv2vdr(void) : housekeeping(&g),epgexecutor(g.EPGSources())
+cPluginXmltv2vdr::cPluginXmltv2vdr(void) : housekeeping(&g),snapshot(&g),epgexecutor(g.EPGSources())
 {
     // Initialize any member variables here.
     // DON'T DO ANYTHING ELSE THAT MAY HAVE SIDE EFFECTS, REQUIRE GLOBAL
     // VDR OBJECTS TO EXIST OR PRODUCE ANY OUTPUT!
     logfile=NULL;
     last_maintime_t=0;
-    last_epcheck_t=last_housetime_t=time(NULL); // start this threads later!
+    last_epcheck_t=last_housetime_t=last_snapshot_t=time(NULL); // start this threads later!
     last_timer_t=last_epcheck_t-(time_t) 540; // check timers in 60 seconds
     g.SetEPAll(0);
     g.TEXTMappings()->Add(new cTEXTMapping("country",tr("country")));
@@ -1073,7 +1408,7 @@ void cPluginXmltv2vdr::GetSqliteCompileOptions()
     if (ret!=SQLITE_OK)
     {
         esyslog("%i %s (gsco)",ret,sqlite3_errmsg(db));
-        sqlite3_close(db);
+        cEPGDatabase::Close(db);
         return ;
     }
 
@@ -1083,7 +1418,6 @@ void cPluginXmltv2vdr::GetSqliteCompileOptions()
         {
             const char *option=(const char *) sqlite3_column_text(stmt,0);
             tsyslog("option %s",option);
-            if (!strncasecmp(option,"SOUNDEX",7)) g.SetSoundEx();
         }
         else
         {
@@ -1091,14 +1425,115 @@ void cPluginXmltv2vdr::GetSqliteCompileOptions()
         }
     }
     sqlite3_finalize(stmt);
-    sqlite3_close(db);
+    cEPGDatabase::Close(db);
     return;
 }
 
+cString cPluginXmltv2vdr::FullTextSearch(const char *Option, int &ReplyCode)
+{
+    if (!cEPGDatabase::FullText())
+    {
+        ReplyCode=550;
+        return "full text search not enabled\n";
+    }
+    if (!Option || !*Option)
+    {
+        ReplyCode=501;
+        return "missing query\n";
+    }
+
+    // leading channel:, from: and to: words restrict the search
+    char *channelid=NULL;
+    time_t from=time(NULL),to=0;
+    const char *query=Option;
+    for (;;)
+    {
+        query=skipspace(query);
+        const char *end=strchr(query,' ');
+        if (!end) break;
+        if (!strncasecmp(query,"channel:",8))
+        {
+            free(channelid);
+            channelid=strndup(query+8,end-query-8);
+        }
+        else if (!strncasecmp(query,"from:",5))
+        {
+            from=(time_t) atol(query+5);
+        }
+        else if (!strncasecmp(query,"to:",3))
+        {
+            to=(time_t) atol(query+3);
+        }
+        else
+        {
+            break;
+        }
+        query=end;
+    }
+
+    sqlite3 *db=cEPGDatabase::Open(g.EPGFile(),SQLITE_OPEN_READONLY);
+    if (!db)
+    {
+        free(channelid);
+        ReplyCode=550;
+        return "no database\n";
+    }
+
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db,"select epg.channelid,epg.starttime,epg.duration,epg.title,epg.shorttext " \
+                           "from epgfts join epg on epg.rowid=epgfts.rowid where epgfts match ?1 and " \
+                           "(?2 is null or epg.channelid=?2) and epg.endtime>?3 and (?4=0 or epg.starttime<?4) " \
+                           "order by epgfts.rank limit 100;",-1,&stmt,NULL)!=SQLITE_OK)
+    {
+        cString err=cString::sprintf("%s\n",sqlite3_errmsg(db));
+        cEPGDatabase::Close(db);
+        free(channelid);
+        ReplyCode=550;
+        return err;
+    }
+    sqlite3_bind_text(stmt,1,query,-1,SQLITE_STATIC);
+    if (channelid) sqlite3_bind_text(stmt,2,channelid,-1,SQLITE_STATIC);
+    sqlite3_bind_int64(stmt,3,from);
+    sqlite3_bind_int64(stmt,4,to);
+
+    char *result=NULL;
+    int ret;
+    while ((ret=sqlite3_step(stmt))==SQLITE_ROW)
+    {
+        char *line;
+        if (asprintf(&line,"%s %lli %i %s~%s\n",sqlite3_column_text(stmt,0),sqlite3_column_int64(stmt,1),
+                     sqlite3_column_int(stmt,2),sqlite3_column_text(stmt,3) ? (const char *) sqlite3_column_text(stmt,3) : "",
+                     sqlite3_column_text(stmt,4) ? (const char *) sqlite3_column_text(stmt,4) : "")==-1) break;
+        result=strcatrealloc(result,line);
+        free(line);
+    }
+    cString output;
+    if (ret!=SQLITE_DONE && ret!=SQLITE_ROW)
+    {
+        ReplyCode=501;
+        output=cString::sprintf("%s\n",sqlite3_errmsg(db));
+    }
+    else if (!result)
+    {
+        ReplyCode=550;
+        output="no matches\n";
+    }
+    else
+    {
+        ReplyCode=250;
+        output=result;
+    }
+    free(result);
+    sqlite3_finalize(stmt);
+    cEPGDatabase::Close(db);
+    free(channelid);
+    return output;
+}
+
 int cPluginXmltv2vdr::GetLastImportSource()
 {
     sqlite3 *db=NULL;
-    if (sqlite3_open_v2(g.EPGFile(),&db,SQLITE_OPEN_READWRITE,NULL)!=SQLITE_OK) return -1;
+    if (!(db=cEPGDatabase::Open(g.EPGFile(),SQLITE_OPEN_READONLY))) return -1;
 
     char sql[]="select srcidx from epg where srcidx<>99 order by starttime desc limit 1";
     sqlite3_stmt *stmt;
@@ -1107,7 +1542,7 @@ int cPluginXmltv2vdr::GetLastImportSource()
     if (ret!=SQLITE_OK)
     {
         esyslog("%i %s (glis)",ret,sqlite3_errmsg(db));
-        sqlite3_close(db);
+        cEPGDatabase::Close(db);
         return -1;
     }
 
@@ -1117,7 +1552,7 @@ int cPluginXmltv2vdr::GetLastImportSource()
         idx=sqlite3_column_int(stmt,0);
     }
     sqlite3_finalize(stmt);
-    sqlite3_close(db);
+    cEPGDatabase::Close(db);
     tsyslog("lastimportsource=%i",idx);
     return idx;
 }
@@ -1135,7 +1570,9 @@ const char *cPluginXmltv2vdr::CommandLineHelp(void)
            "  -i DIR    --images=DIR   location of epgimages\n"
            "                           (default is /var/cache/vdr/epgimages)\n"
            "  -l FILE   --logfile=FILE write trace logs into the given FILE (default is\n"
-           "                           no trace log\n";
+           "                           no trace log\n"
+           "  -s,       --search       keep a full text index for the SVDRP command SRCH\n"
+           "                           (needs sqlite with FTS5)\n";
 }
 
 bool cPluginXmltv2vdr::ProcessArgs(int argc, char *argv[])
@@ -1147,11 +1584,12 @@ bool cPluginXmltv2vdr::ProcessArgs(int argc, char *argv[])
         { "epgfile",      required_argument, NULL, 'E'},
         { "images",       required_argument, NULL, 'i'},
         { "logfile",      required_argument, NULL, 'l'},
+        { "search",       no_argument,       NULL, 's'},
         { 0,0,0,0 }
     };
 
     int c;
-    while ((c = getopt_long(argc, argv, "l:e:E:i:", long_options, NULL)) != -1)
+    while ((c = getopt_long(argc, argv, "l:e:E:i:s", long_options, NULL)) != -1)
     {
         switch (c)
         {
@@ -1168,6 +1606,9 @@ bool cPluginXmltv2vdr::ProcessArgs(int argc, char *argv[])
             if (logfile) free(logfile);
             logfile=strdup(optarg);
             break;
+        case 's':
+            cEPGDatabase::SetFullText(true);
+            break;
         default:
             return false;
         }
@@ -1189,7 +1630,16 @@ bool cPluginXmltv2vdr::Start(void)
     isyslog("using codeset '%s'",g.Codeset());
     isyslog("using file '%s' for epg database (storage)",g.EPGFileStore());
     isyslog("using file '%s' for epg database (runtime)",g.EPGFile());
-    g.CopyEPGFile(true);
+    snapshot.Restore();
+    // schema changes run once here, before the EIT handler and the writer use epg.db
+    sqlite3 *db=cEPGDatabase::Open(g.EPGFile());
+    if (db)
+    {
+        cEPGDatabase::Migrate(db);
+        cEPGDatabase::Close(db);
+    }
+    g.WatchDB();
+    g.DBChanged();
     if (g.EPDir())
     {
         isyslog("using dir '%s' (%s) for episodes",g.EPDir(),g.EPCodeset());
@@ -1202,10 +1652,13 @@ bool cPluginXmltv2vdr::Start(void)
     if (g.ImgDir()) isyslog("using dir '%s' for epgimages (%i)",g.ImgDir(),g.ImgDelAfter());
 
     g.EPGSources()->ReadIn(&g);
+    g.AllocateXMLTVWriter();
+    g.XMLTVWriter()->Start();
     g.epghandler = new cEPGHandler(&g);
     g.SetEPAll(g.EPAll());
     isyslog("using sqlite v%s",sqlite3_libversion());
     GetSqliteCompileOptions();
+    g.SetSoundEx(); // soundex_title is computed by the plugin, no sqlite support needed
     if (sqlite3_threadsafe()==0) esyslog("sqlite3 not threadsafe!");
     sqlite3_enable_shared_cache(0);
     cParse::InitLibXML();
@@ -1217,13 +1670,15 @@ void cPluginXmltv2vdr::Stop(void)
     // Stop any background activities the plugin is performing.
     epgexecutor.Stop();
     housekeeping.Stop();
+    if (g.XMLTVWriter()) g.XMLTVWriter()->Stop();
     cParse::CleanupLibXML();
+    snapshot.Stop();
+    if (snapshot.Dirty()) snapshot.Save(true);
     if (logfile)
     {
         free(logfile);
         logfile=NULL;
     }
-    g.CopyEPGFile(false);
 }
 
 void cPluginXmltv2vdr::Housekeeping(void)
@@ -1238,16 +1693,22 @@ void cPluginXmltv2vdr::Housekeeping(void)
         }
         last_housetime_t=(now / 3600)*3600;
     }
+    if (now>(last_snapshot_t+3600))
+    {
+        if (snapshot.Dirty()) snapshot.Save();
+        last_snapshot_t=now;
+    }
 }
 
 void cPluginXmltv2vdr::MainThreadHook(void)
 {
     // Perform actions in the context of the main program thread.
     // WARNING: Use with great care - see PLUGINS.html!
+    g.CheckDBWatch();
     time_t now=time(NULL);
     if (now>=(last_maintime_t+60))
     {
-        if (!epgexecutor.Active())
+        if (!epgexecutor.Active() && !snapshot.Active())
         {
             if (g.EPGSources()->RunItNow()) epgexecutor.Start();
         }
@@ -1264,10 +1725,12 @@ void cPluginXmltv2vdr::MainThreadHook(void)
         */
         if (g.EPAll())
         {
-            if (now>=(last_timer_t+600))
+            if (now>=(last_timer_t+10))
             {
-                if (g.EPGTimer()) g.EPGTimer()->Start();
-                last_timer_t=(now/600)*600;
+                // only when timers were added, edited or rebound
+                if (g.EPGTimer() && !g.EPGTimer()->Active() && g.EPGTimer()->TimersChanged())
+                    g.EPGTimer()->Start();
+                last_timer_t=now;
             }
         }
     }
@@ -1276,7 +1739,7 @@ void cPluginXmltv2vdr::MainThreadHook(void)
 cString cPluginXmltv2vdr::Active(void)
 {
     // Return a message string if shutdown should be postponed
-    if (epgexecutor.Active())
+    if (epgexecutor.Active() || snapshot.Active())
     {
         return tr("xmltv2vdr plugin still working");
     }
@@ -1377,6 +1840,11 @@ const char **cPluginXmltv2vdr::SVDRPHelpPages(void)
         "    Start housekeeping manually\n",
         "TIMR\n"
         "    Start timerthread manually\n",
+        "SRCH [channel:<channelid>] [from:<time>] [to:<time>] <query>\n"
+        "    Search titles, short texts and descriptions (needs --search).\n"
+        "    Times are unix timestamps, the query uses the sqlite FTS5 syntax.\n"
+        "    Returns up to 100 ranked matches as\n"
+        "    '<channelid> <starttime> <duration> <title>~<shorttext>'\n",
         NULL
     };
     return HelpPages;
@@ -1428,13 +1896,15 @@ cString cPluginXmltv2vdr::SVDRPCommand(const char *Command, const char *Option,
     {
         if (g.EPGFile())
         {
-            if (unlink(g.EPGFile())==-1)
+            if (!cEPGDatabase::Unlink(g.EPGFile()))
             {
                 ReplyCode=550;
                 output="failed to delete database\n";
             }
             else
             {
+                g.XMLTVCache()->Clear();
+                g.DBChanged();
                 ReplyCode=250;
                 output="database deleted\n";
             }
@@ -1445,12 +1915,17 @@ cString cPluginXmltv2vdr::SVDRPCommand(const char *Command, const char *Option,
             output="epgfile parameter not set\n";
         }
     }
+    if (!strcasecmp(Command,"SRCH"))
+    {
+        output=FullTextSearch(Option,ReplyCode);
+    }
     if (!strcasecmp(Command,"TIMR"))
     {
         if (!epgexecutor.Active() && g.EPGTimer() && !g.EPGTimer()->Active())
         {
+            g.EPGTimer()->ForceAll();
             g.EPGTimer()->Start();
-            last_timer_t=(time(NULL)/600)*600;
+            last_timer_t=time(NULL);
             ReplyCode=250;
             output="timerthread started\n";
         }
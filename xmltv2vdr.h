@@ -9,11 +9,18 @@
 #define _XMLTV2VDR_H
 
 #include <sqlite3.h>
+#include <atomic>
+#include <map>
+#include <vector>
 #include <vdr/plugin.h>
 #include "maps.h"
 #include "parse.h"
 #include "import.h"
 #include "source.h"
+#include "cache.h"
+#include "writer.h"
+#include "db.h"
+#include "compress.h"
 
 #if __GNUC__ > 3
 #define UNUSED(v) UNUSED_ ## v __attribute__((unused))
@@ -62,12 +69,31 @@ private:
     cEPGMappings *maps;
     cImport import;
     int epall;
+    struct enrichment
+    {
+        tEventID eventid;
+        time_t starttime;
+        uint64_t timer;
+        bool seen;
+    };
+    std::map<uint64_t,enrichment> enriched; // per timer, last processed state
+    std::atomic<bool> force; // set by the svdrp thread
+#if VDRVERSNUM>=20301
+    cStateKey timerskey;
+#else
+    int timersstate;
+#endif
 public:
     cEPGTimer(cGlobals *Global);
     void Stop()
     {
         Cancel(3);
     }
+    bool TimersChanged();
+    void ForceAll()
+    {
+        force=true;
+    }
     void SetEPAll(int Value)
     {
         epall=Value;
@@ -114,12 +140,30 @@ private:
     cEPGMappings *maps;
     cEPGSources *sources;
     cImport import;
+    cXMLTVCache *cache;
+    cGlobals *global;
     int epall;
     sqlite3 *db;
     time_t now;
     bool check4proc(cEvent *event, cEPGMapping **map);
+    struct memo
+    {
+        uint64_t description; // last SetDescription call
+        bool descresult;
+        uint64_t handled; // event state after HandleEvent
+        time_t end;
+    };
+    std::map<uint64_t,memo> memos;
+    uint64_t memogeneration;
+    int dbgeneration;
+    time_t lastprune;
+    memo *getmemo(const cEvent *Event);
+    uint64_t eventstate(const cEvent *Event, const char *Description);
+    bool setdescription(cEvent *Event, const char *Description);
+    bool handleevent(cEvent *Event, cEPGMapping *map);
 public:
     cEPGHandler(cGlobals *Global);
+    ~cEPGHandler();
     void SetEPAll(int Value)
     {
         epall=Value;
@@ -149,6 +193,33 @@ public:
     virtual void Action();
 };
 
+// consistent copy of the runtime epg.db to/from the store location,
+// done with the sqlite online backup api in small steps
+class cEPGSnapshot : public cThread
+{
+private:
+    cGlobals *global;
+    time_t last;
+    enum
+    {
+        PAGES=256,
+        MAXRESTARTS=3,
+        RECENT=900 // seconds, newer snapshots are not saved again on shutdown
+    };
+    bool copy(const char *From, const char *To, bool Wait);
+public:
+    cEPGSnapshot(cGlobals *Global);
+    bool Enabled();
+    bool Dirty();
+    void Restore();
+    void Save(bool Wait=false);
+    void Stop()
+    {
+        Cancel(3);
+    }
+    virtual void Action();
+};
+
 class cEPGSeasonEpisode : public cThread
 {
 private:
@@ -174,6 +245,7 @@ private:
     char *imgdir;
     char *codeset;
     char *order;
+    std::atomic<int> setupgeneration;
     char *srcorder;
     int epall;
     int imgdelafter;
@@ -182,13 +254,32 @@ private:
     cEPGMappings epgmappings;
     cTEXTMappings textmappings;
     cEPGSources epgsources;
+    cXMLTVCache xmltvcache;
     cEPGTimer *epgtimer;
     cEPGSeasonEpisode *epgseasonepisode;
+    cXMLTVWriter *xmltvwriter;
+    std::atomic<int> dbgeneration;
+    std::atomic<bool> dbexists;
+    int dbwatch;
+    char *dbwatchname;
+    uint64_t dbid;
+    uint64_t DBIdentity();
 public:
     cGlobals();
     ~cGlobals();
     cEPGHandler *epghandler;
     bool DBExists();
+    void DBChanged();
+    void WatchDB();
+    void CheckDBWatch();
+    bool DBAvailable()
+    {
+        return dbexists;
+    }
+    int DBGeneration()
+    {
+        return dbgeneration;
+    }
     char *GetDefaultOrder();
     void AllocateEPGTimerThread()
     {
@@ -198,6 +289,14 @@ public:
     {
         if (!epgseasonepisode) epgseasonepisode=new cEPGSeasonEpisode(this);
     }
+    void AllocateXMLTVWriter()
+    {
+        if (!xmltvwriter) xmltvwriter=new cXMLTVWriter(this);
+    }
+    cXMLTVWriter *XMLTVWriter()
+    {
+        return xmltvwriter;
+    }
     cEPGSeasonEpisode *EPGSeasonEpisode()
     {
         return epgseasonepisode;
@@ -218,6 +317,10 @@ public:
     {
         return &epgsources;
     }
+    cXMLTVCache *XMLTVCache()
+    {
+        return &xmltvcache;
+    }
     void SetConfDir(const char *ConfDir)
     {
         free(confdir);
@@ -227,7 +330,6 @@ public:
     {
         return confdir;
     }
-    void CopyEPGFile(bool Init);
     bool CheckEPGDir(const char *EPGFileDir);
     void SetEPGFile(const char *EPGFile);
     const char *EPGFile()
@@ -277,11 +379,20 @@ public:
     {
         free(order);
         order=strdup(NewOrder);
+        SetupChanged();
     }
     const char *Order()
     {
         return order;
     }
+    void SetupChanged()
+    {
+        setupgeneration++;
+    }
+    int SetupGeneration()
+    {
+        return setupgeneration;
+    }
     void SetEPAll(int Value)
     {
         epall=Value;
@@ -310,6 +421,7 @@ public:
     void SetSoundEx()
     {
         soundex=true;
+        xmltvcache.SetSoundEx(true);
     }
     bool SoundEx()
     {
@@ -322,13 +434,16 @@ class cPluginXmltv2vdr : public cPlugin
 private:
     cGlobals g;
     cHouseKeeping housekeeping;
+    cEPGSnapshot snapshot;
     cEPGExecutor epgexecutor;
     time_t last_housetime_t;
+    time_t last_snapshot_t;
     time_t last_maintime_t;
     time_t last_timer_t;
     time_t last_epcheck_t;
     void GetSqliteCompileOptions();
     int GetLastImportSource();
+    cString FullTextSearch(const char *Option, int &ReplyCode);
 public:
     cPluginXmltv2vdr(void);
     virtual ~cPluginXmltv2vdr();